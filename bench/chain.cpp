@@ -0,0 +1,101 @@
+/*
+ * cost of query depth: from(v) followed by 1, 2, 4, 8 and 16 where, select, skip or take
+ * stages, or a mix of all four, each stage wrapping the previous one in another type erased
+ * iterator. prints ns per element produced for every depth and the marginal cost of one
+ * more stage, for a trivially copyable and a heavy element type, next to the plain loop.
+ * argv[1] sets the element count (default 1e6); data is seeded, so runs are comparable
+ */
+#include "harness.h"
+#include "data.h"
+#include "../enumerable.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+const int depths[] = { 1, 2, 4, 8, 16 };
+const char* const stages[] = { "where", "select", "skip", "take", "mixed" };
+
+template <typename Type>
+sb::enumerable<Type> chain(sb::enumerable<Type> query, const std::string& stage, int depth, int size)
+{
+    typedef data<Type> Data;
+
+    for (int i = 0; i < depth; ++i) {
+        std::string kind = stage == "mixed" ? stages[i % 4] : stage;
+
+        if (kind == "where") {
+            query = query.where([](const Type& value) { return Data::key(value) >= 0; });
+
+        } else if (kind == "select") {
+            query = query.select([](const Type& value) { return value; });
+
+        } else if (kind == "skip") {
+            query = query.skip(1);
+
+        } else {
+            query = query.take(size);
+        }
+    }
+
+    return query;
+}
+
+template <typename Type>
+void run(std::size_t size)
+{
+    typedef data<Type> Data;
+
+    const auto v = Data::make(size, 1);
+    auto loop = bench::measure(size, [&]() {
+        std::uint64_t sum = 0;
+        for (auto& value : v) {
+            sum += Data::weight(value);
+        }
+        return sum;
+    });
+
+    std::printf("%-8s %-8s %10.2f\n", Data::name(), "loop", loop.ns);
+
+    for (auto stage : stages) {
+        double first = 0;
+        double last = 0;
+
+        std::printf("%-8s %-8s", Data::name(), stage);
+
+        for (auto depth : depths) {
+            auto result = bench::measure(size, [&]() {
+                std::uint64_t sum = 0;
+                for (const auto& value : chain(sb::from(v), stage, depth, static_cast<int>(size))) {
+                    sum += Data::weight(value);
+                }
+                return sum;
+            });
+
+            std::printf(" %10.2f", result.ns);
+            first = depth == depths[0] ? result.ns : first;
+            last = result.ns;
+        }
+
+        std::printf(" %10.2f\n", (last - first) / (depths[4] - depths[0]));
+        std::fflush(stdout);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t size = argc > 1 ? static_cast<std::size_t>(std::atof(argv[1])) : 1000000;
+
+    std::printf("chain depth, %zu elements, ns per element\n", size);
+    std::printf("%-8s %-8s", "type", "stage");
+
+    for (auto depth : depths) {
+        std::printf(" %10d", depth);
+    }
+
+    std::printf(" %10s\n", "per stage");
+
+    run<int>(size);
+    run<student_t>(size);
+    return 0;
+}
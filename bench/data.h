@@ -0,0 +1,189 @@
+/* element types and generators shared by the benchmark programs, seeded so runs repeat */
+#ifndef _BENCH_DATA_H_
+#define _BENCH_DATA_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+struct student_t {
+    int id;
+    std::string name;
+    int age;
+    double score;
+};
+
+inline bool operator==(const student_t& lhs, const student_t& rhs)
+{
+    return lhs.id == rhs.id && lhs.name == rhs.name && lhs.age == rhs.age && lhs.score == rhs.score;
+}
+
+namespace std {
+    template <>
+    struct hash<student_t> {
+        std::size_t operator()(const student_t& value) const
+        {
+            return std::hash<int>()(value.id);
+        }
+    };
+};
+
+/* source data, a small join key and an integral weight the checksums are built from */
+template <typename Type>
+struct data;
+
+template <>
+struct data<int> {
+    static const char* name(void) { return "int"; }
+
+    static std::vector<int> make(std::size_t size, unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<int> values(size);
+
+        for (auto& value : values) {
+            value = static_cast<int>(random() % size);
+        }
+
+        return values;
+    }
+
+    static int key(int value) { return value & 1023; }
+    static std::uint64_t weight(int value) { return static_cast<std::uint64_t>(value); }
+};
+
+template <>
+struct data<double> {
+    static const char* name(void) { return "double"; }
+
+    static std::vector<double> make(std::size_t size, unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<double> values(size);
+
+        for (auto& value : values) {
+            value = static_cast<double>(random() % (size * 4)) / 4;
+        }
+
+        return values;
+    }
+
+    static int key(double value) { return static_cast<int>(value) & 1023; }
+    static std::uint64_t weight(double value) { return static_cast<std::uint64_t>(value * 4); }
+};
+
+template <>
+struct data<std::string> {
+    static const char* name(void) { return "string"; }
+
+    static std::vector<std::string> make(std::size_t size, unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<std::string> values(size);
+
+        for (auto& value : values) {
+            value = "user-" + std::to_string(random() % size);
+        }
+
+        return values;
+    }
+
+    static int key(const std::string& value) { return (value[value.size() - 1] * 31 + value[value.size() - 2]) & 1023; }
+    static std::uint64_t weight(const std::string& value) { return value.size() * 131 + static_cast<unsigned char>(value.back()); }
+};
+
+template <>
+struct data<student_t> {
+    static const char* name(void) { return "student"; }
+
+    static std::vector<student_t> make(std::size_t size, unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<student_t> values(size);
+
+        for (auto& value : values) {
+            value.id = static_cast<int>(random() % size);
+            value.name = "student-" + std::to_string(value.id);
+            value.age = 18 + static_cast<int>(random() % 10);
+            value.score = static_cast<double>(random() % 100);
+        }
+
+        return values;
+    }
+
+    static int key(const student_t& value) { return value.id & 1023; }
+    static std::uint64_t weight(const student_t& value) { return static_cast<std::uint64_t>(value.id); }
+};
+
+/*
+ * Zipf(skew) over the keys 0 .. keys - 1, key 0 the most frequent; skew 0 is uniform and
+ * around 1 a handful of keys carry most rows. draws are built from the raw 64-bit output,
+ * not std::uniform_real_distribution, so the same seed gives the same keys on every library
+ */
+class zipf {
+public:
+    zipf(std::size_t keys, double skew) :
+        m_cdf(keys)
+    {
+        double total = 0;
+
+        for (std::size_t i = 0; i < keys; ++i) {
+            total += 1.0 / std::pow(double(i + 1), skew);
+            m_cdf[i] = total;
+        }
+
+        for (auto& bound : m_cdf) {
+            bound /= total;
+        }
+    }
+
+    std::size_t operator()(std::mt19937_64& random) const
+    {
+        double uniform = double(random() >> 11) / 9007199254740992.0;
+        return std::min<std::size_t>(std::upper_bound(m_cdf.begin(), m_cdf.end(), uniform) - m_cdf.begin(), m_cdf.size() - 1);
+    }
+
+private:
+    std::vector<double> m_cdf;
+};
+
+/* the readme record at scale: a last name, four to eight scores and a class drawn from zipf */
+struct record_t {
+    std::string last_name;
+    std::vector<int> scores;
+    int class_id;
+};
+
+inline std::vector<record_t> make_records(std::size_t size, std::size_t classes, double skew, unsigned seed)
+{
+    static const char* const syllables[] = { "an", "bel", "cor", "dan", "el", "fer", "gar", "han", "ib", "jo", "ka", "lo", "mor", "ne", "o", "par" };
+
+    std::mt19937_64 random(seed);
+    zipf class_of(classes, skew);
+    std::vector<record_t> values(size);
+
+    for (auto& value : values) {
+        auto bits = random();
+
+        for (int i = 0; i < 3; ++i, bits >>= 4) {
+            value.last_name += syllables[bits & 15];
+        }
+
+        value.last_name += std::to_string(bits % (size + 1));
+        value.scores.resize(4 + random() % 5);
+
+        for (auto& score : value.scores) {
+            score = 40 + static_cast<int>(random() % 61);
+        }
+
+        value.class_id = static_cast<int>(class_of(random));
+    }
+
+    return values;
+}
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * shared by the benchmark programs: global allocation accounting, timing and the report
+ * table. every benchmark program is a single translation unit that includes this once
+ */
+#ifndef _BENCH_HARNESS_H_
+#define _BENCH_HARNESS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+namespace bench {
+    struct heap_counters {
+        std::atomic<std::size_t> allocations;
+        std::atomic<std::size_t> live;
+        std::atomic<std::size_t> peak;
+    };
+
+    inline heap_counters& heap(void)
+    {
+        static heap_counters counters;
+        return counters;
+    }
+
+    /* every block carries its size in front so delete can account for it */
+    const std::size_t header = 16;
+
+    inline void* allocate(std::size_t size)
+    {
+        void* block = std::malloc(size + header);
+
+        if (!block) {
+            return nullptr;
+        }
+
+        *static_cast<std::size_t*>(block) = size;
+
+        auto& counters = heap();
+        counters.allocations.fetch_add(1, std::memory_order_relaxed);
+        std::size_t live = counters.live.fetch_add(size, std::memory_order_relaxed) + size;
+        std::size_t peak = counters.peak.load(std::memory_order_relaxed);
+
+        while (live > peak && !counters.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+
+        return static_cast<char*>(block) + header;
+    }
+
+    inline void deallocate(void* pointer)
+    {
+        if (pointer) {
+            void* block = static_cast<char*>(pointer) - header;
+            heap().live.fetch_sub(*static_cast<std::size_t*>(block), std::memory_order_relaxed);
+            std::free(block);
+        }
+    }
+
+    /* process peak resident set in KiB */
+    inline long peak_rss_kb(void)
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    struct measurement {
+        double ns;              // per element
+        double allocations;     // per element
+        std::size_t peak_bytes; // heap high water above what was live before the run
+        std::uint64_t checksum;
+    };
+
+    /*
+     * the fastest of three batches, each repeating run until it takes at least 20ms;
+     * allocations and heap peak come from one extra, untimed run
+     */
+    static volatile std::uint64_t sink;
+
+    template <typename Functor>
+    measurement measure(std::size_t elements, const Functor& run)
+    {
+        typedef std::chrono::steady_clock clock;
+
+        measurement result;
+        auto& counters = heap();
+        std::size_t allocations = counters.allocations.load();
+        std::size_t live = counters.live.load();
+
+        counters.peak.store(live);
+        result.checksum = run();
+        result.allocations = double(counters.allocations.load() - allocations) / double(elements ? elements : 1);
+        result.peak_bytes = counters.peak.load() - live;
+
+        double best = 0;
+        std::size_t repeats = 1;
+
+        for (int batch = 0; batch < 3; ++batch) {
+            double elapsed = 0;
+
+            for (;;) {
+                auto start = clock::now();
+
+                for (std::size_t i = 0; i < repeats; ++i) {
+                    sink = run();
+                }
+
+                elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+                if (elapsed >= 2e7 || batch > 0) {
+                    break;
+                }
+
+                repeats *= 2;
+            }
+
+            double per_run = elapsed / double(repeats);
+
+            if (batch == 0 || per_run < best) {
+                best = per_run;
+            }
+        }
+
+        result.ns = best / double(elements ? elements : 1);
+        return result;
+    }
+
+    inline void print_header(void)
+    {
+        std::printf("%-16s %-8s %10s %12s %12s %8s %12s %12s\n",
+            "operator", "type", "elements", "linq ns/el", "loop ns/el", "ratio", "allocs/el", "peak heap");
+    }
+
+    inline bool print_row(const char* name, const char* type, std::size_t elements, const measurement& linq, const measurement& loop)
+    {
+        std::printf("%-16s %-8s %10zu %12.2f %12.2f %8.2f %12.3f %12zu%s\n",
+            name, type, elements, linq.ns, loop.ns, loop.ns > 0 ? linq.ns / loop.ns : 0.0,
+            linq.allocations, linq.peak_bytes, linq.checksum == loop.checksum ? "" : "  MISMATCH");
+        std::fflush(stdout);
+        return linq.checksum == loop.checksum;
+    }
+
+    struct latency {
+        double p50;             // ms per run
+        double p99;
+        double max;
+        std::uint64_t checksum;
+    };
+
+    /* nearest rank percentile of sorted run times */
+    inline double percentile(const std::vector<double>& sorted, double rank)
+    {
+        std::size_t index = static_cast<std::size_t>(rank / 100 * double(sorted.size()) + 0.999999);
+        return sorted[std::min(sorted.size(), std::max<std::size_t>(index, 1)) - 1];
+    }
+
+    /* one untimed warm up run, then runs individually timed runs of the whole query */
+    template <typename Functor>
+    latency measure_latency(std::size_t runs, const Functor& run)
+    {
+        typedef std::chrono::steady_clock clock;
+
+        latency result;
+        std::vector<double> times;
+
+        result.checksum = run();
+
+        for (std::size_t i = 0; i < runs; ++i) {
+            auto start = clock::now();
+            sink = run();
+            times.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+        }
+
+        std::sort(times.begin(), times.end());
+        result.p50 = percentile(times, 50);
+        result.p99 = percentile(times, 99);
+        result.max = times.back();
+        return result;
+    }
+
+    inline void print_latency_header(void)
+    {
+        std::printf("%-24s %6s %10s %10s %10s %10s %10s %8s %12s\n",
+            "scenario", "skew", "rows", "linq p50", "linq p99", "linq max", "loop p50", "ratio", "Mrows/s");
+    }
+
+    inline bool print_latency_row(const char* name, double skew, std::size_t rows, const latency& linq, const latency& loop)
+    {
+        std::printf("%-24s %6.2f %10zu %8.3fms %8.3fms %8.3fms %8.3fms %8.2f %12.2f%s\n",
+            name, skew, rows, linq.p50, linq.p99, linq.max, loop.p50, loop.p50 > 0 ? linq.p50 / loop.p50 : 0.0,
+            linq.p50 > 0 ? double(rows) / linq.p50 / 1000 : 0.0, linq.checksum == loop.checksum ? "" : "  MISMATCH");
+        std::fflush(stdout);
+        return linq.checksum == loop.checksum;
+    }
+
+    /* 1e3, 1e4, ... up to max */
+    inline std::vector<std::size_t> decades(std::size_t max)
+    {
+        std::vector<std::size_t> sizes;
+
+        for (std::size_t size = 1000; size <= max; size *= 10) {
+            sizes.push_back(size);
+        }
+
+        return sizes;
+    }
+
+    inline bool selected(const char* name, const std::string& filter)
+    {
+        return filter.empty() || std::strstr(name, filter.c_str()) != nullptr;
+    }
+};
+
+void* operator new(std::size_t size)
+{
+    void* pointer = bench::allocate(size ? size : 1);
+
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+
+    return pointer;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return bench::allocate(size ? size : 1);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    bench::deallocate(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    bench::deallocate(pointer);
+}
+
+#endif
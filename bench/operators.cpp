@@ -0,0 +1,339 @@
+/*
+ * times every operator against the hand-written loop computing the same result, for int,
+ * double, std::string and a student record, at 1e3 elements up to argv[1] (default 1e6).
+ * argv[2] keeps only the operators whose name contains it. both sides return a checksum,
+ * a row is flagged MISMATCH when they disagree
+ */
+#include "harness.h"
+#include "data.h"
+#include "../enumerable.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+template <typename Type>
+class suite {
+private:
+    typedef data<Type> Data;
+    typedef std::pair<int, std::uint64_t> Dimension;
+
+    std::string m_filter;
+    bool m_ok;
+
+public:
+    explicit suite(const std::string& filter) :
+        m_filter(filter),
+        m_ok(true)
+    {
+    }
+
+    bool ok(void) const
+    {
+        return m_ok;
+    }
+
+    void run(std::size_t size)
+    {
+        const auto v = Data::make(size, 1);
+        const auto other = Data::make(size / 2 + 1, 2);
+        std::vector<Dimension> dimension;
+
+        for (int key = 0; key < 1024; ++key) {
+            dimension.push_back(Dimension(key, static_cast<std::uint64_t>(key) * 7));
+        }
+
+        compare("from", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v)) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        });
+
+        compare("where", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v).where([](const Type& value) { return Data::key(value) < 512; })) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                if (Data::key(value) < 512) {
+                    sum += Data::weight(value);
+                }
+            }
+            return sum;
+        });
+
+        compare("select", size, [&]() {
+            std::uint64_t sum = 0;
+            for (auto weight : sb::from(v).select([](const Type& value) { return Data::weight(value); })) {
+                sum += weight;
+            }
+            return sum;
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        });
+
+        compare("select_many", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v).select_many([](const Type& value) { return std::array<Type, 2>{ { value, value } }; })) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                std::array<Type, 2> pair = { { value, value } };
+                for (auto& element : pair) {
+                    sum += Data::weight(element);
+                }
+            }
+            return sum;
+        });
+
+        compare("take/skip", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v).skip(static_cast<int>(size / 4)).take(static_cast<int>(size / 2))) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (std::size_t i = size / 4; i < size / 4 + size / 2; ++i) {
+                sum += Data::weight(v[i]);
+            }
+            return sum;
+        });
+
+        compare("concat", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v).concat(other)) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                sum += Data::weight(value);
+            }
+            for (auto& value : other) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        });
+
+        compare("reverse", size, [&]() {
+            return ordered(sb::from(v).reverse());
+        }, [&]() {
+            return ordered(std::vector<Type>(v.rbegin(), v.rend()));
+        });
+
+        compare("order_by", size, [&]() {
+            return ordered(sb::from(v).order_by([](const Type& value) { return Data::weight(value); }));
+        }, [&]() {
+            std::vector<Type> values(v);
+            std::stable_sort(values.begin(), values.end(), [](const Type& lhs, const Type& rhs) {
+                return Data::weight(lhs) < Data::weight(rhs);
+            });
+            return ordered(values);
+        });
+
+        compare("to_vector", size, [&]() {
+            auto values = sb::from(v).to_vector();
+            return values.size() + Data::weight(values.back());
+        }, [&]() {
+            std::vector<Type> values(v.begin(), v.end());
+            return values.size() + Data::weight(values.back());
+        });
+
+        compare("aggregate", size, [&]() {
+            return sb::from(v).aggregate(std::uint64_t(0), [](std::uint64_t sum, const Type& value) { return sum + Data::weight(value); });
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                sum += Data::weight(value);
+            }
+            return sum;
+        });
+
+        compare("distinct", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v).distinct()) {
+                sum += Data::weight(value) + 1;
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_set<Type> seen(v.begin(), v.end());
+            std::uint64_t sum = 0;
+            for (auto& value : seen) {
+                sum += Data::weight(value) + 1;
+            }
+            return sum;
+        });
+
+        compare("except_with", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v).except_with(other)) {
+                sum += Data::weight(value) + 1;
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_set<Type> seen(other.begin(), other.end());
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                if (seen.insert(value).second) {
+                    sum += Data::weight(value) + 1;
+                }
+            }
+            return sum;
+        });
+
+        compare("intersect_with", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& value : sb::from(v).intersect_with(other)) {
+                sum += Data::weight(value) + 1;
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_set<Type> right(other.begin(), other.end());
+            std::unordered_set<Type> seen;
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                if (right.count(value) && seen.insert(value).second) {
+                    sum += Data::weight(value) + 1;
+                }
+            }
+            return sum;
+        });
+
+        compare("group_by", size, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& group : sb::from(v).group_by([](const Type& value) { return Data::key(value); })) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second.count();
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_map<int, std::vector<Type>> groups;
+            for (auto& value : v) {
+                groups[Data::key(value)].push_back(value);
+            }
+            std::uint64_t sum = 0;
+            for (const auto& group : groups) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second.size();
+            }
+            return sum;
+        });
+
+        compare("group_aggregate", size, [&]() {
+            std::uint64_t sum = 0;
+            auto groups = sb::from(v).group_aggregate([](const Type& value) { return Data::key(value); },
+                std::uint64_t(0), [](std::uint64_t state, const Type& value) { return state + Data::weight(value); });
+            for (const auto& group : groups) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second;
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_map<int, std::uint64_t> groups;
+            for (auto& value : v) {
+                groups[Data::key(value)] += Data::weight(value);
+            }
+            std::uint64_t sum = 0;
+            for (const auto& group : groups) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second;
+            }
+            return sum;
+        });
+
+        compare("join", size, [&]() {
+            std::uint64_t sum = 0;
+            auto rows = sb::from(v).join(dimension,
+                [](const Type& value) { return Data::key(value); },
+                [](const Dimension& row) { return row.first; });
+            for (const auto& row : rows) {
+                sum += Data::weight(row.second.first) + row.second.second.second;
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_multimap<int, std::uint64_t> table(dimension.begin(), dimension.end());
+            std::uint64_t sum = 0;
+            for (auto& value : v) {
+                auto range = table.equal_range(Data::key(value));
+                for (auto it = range.first; it != range.second; ++it) {
+                    sum += Data::weight(value) + it->second;
+                }
+            }
+            return sum;
+        });
+    }
+
+private:
+    /* order sensitive checksum */
+    template <typename Range>
+    static std::uint64_t ordered(const Range& range)
+    {
+        std::uint64_t sum = 0;
+        std::uint64_t index = 0;
+
+        for (const auto& value : range) {
+            sum += Data::weight(value) * ++index;
+        }
+
+        return sum;
+    }
+
+    template <typename Linq, typename Loop>
+    void compare(const char* name, std::size_t size, const Linq& linq, const Loop& loop)
+    {
+        if (!bench::selected(name, m_filter)) {
+            return;
+        }
+
+        auto linq_result = bench::measure(size, linq);
+        auto loop_result = bench::measure(size, loop);
+        m_ok = bench::print_row(name, Data::name(), size, linq_result, loop_result) && m_ok;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    std::size_t max = argc > 1 ? static_cast<std::size_t>(std::atof(argv[1])) : 1000000;
+    std::string filter = argc > 2 ? argv[2] : "";
+    bool ok = true;
+
+    bench::print_header();
+
+    for (auto size : bench::decades(max)) {
+        suite<int> ints(filter);
+        suite<double> doubles(filter);
+        suite<std::string> strings(filter);
+        suite<student_t> students(filter);
+
+        ints.run(size);
+        doubles.run(size);
+        strings.run(size);
+        students.run(size);
+
+        ok = ok && ints.ok() && doubles.ok() && strings.ok() && students.ok();
+    }
+
+    std::printf("peak rss: %ld KiB\n", bench::peak_rss_kb());
+    return ok ? 0 : 1;
+}
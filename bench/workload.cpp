@@ -0,0 +1,286 @@
+/*
+ * whole queries on readme shaped records (a last name and four to eight scores) scaled to
+ * argv[1] rows (default 1e6), with the class key of group_by and join drawn from Zipf at
+ * skew 0 (uniform), 0.8 and 1.2. every query is run argv[2] times (default 101) and the
+ * p50, p99 and worst run are reported next to the p50 of the hand-written loop. argv[3]
+ * keeps only the scenarios whose name contains it. data is seeded, so runs are comparable
+ */
+#include "harness.h"
+#include "data.h"
+#include "../enumerable.h"
+
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+const std::size_t classes = 1000;
+const double skews[] = { 0.0, 0.8, 1.2 };
+
+inline int average(const record_t& record)
+{
+    return std::accumulate(record.scores.begin(), record.scores.end(), 0) / static_cast<int>(record.scores.size());
+}
+
+class workload {
+private:
+    typedef std::pair<int, std::string> Class;
+
+    std::vector<record_t> m_records;
+    std::vector<Class> m_classes;
+    std::size_t m_runs;
+    std::string m_filter;
+    double m_skew;
+    bool m_ok;
+
+public:
+    workload(std::size_t rows, double skew, std::size_t runs, const std::string& filter) :
+        m_records(make_records(rows, classes, skew, 1)),
+        m_runs(runs),
+        m_filter(filter),
+        m_skew(skew),
+        m_ok(true)
+    {
+        for (std::size_t i = 0; i < classes; ++i) {
+            m_classes.push_back(Class(static_cast<int>(i), "class-" + std::to_string(i)));
+        }
+    }
+
+    bool ok(void) const
+    {
+        return m_ok;
+    }
+
+    /* the readme query, finished by different terminal operators; does not depend on the skew */
+    void run_readme(void)
+    {
+        const auto& records = m_records;
+
+        auto query = [&records]() {
+            return sb::from(records).let([](const record_t& record) {
+                return average(record);
+            }).where([](const sb::let_value<record_t, int>& record) {
+                return record.value() > 80;
+            });
+        };
+
+        compare("readme to_vector", [&]() {
+            auto scores = query().select([](const sb::let_value<record_t, int>& record) {
+                return std::make_pair(record.element().last_name, record.value());
+            }).to_vector();
+            std::uint64_t sum = scores.size();
+            for (auto& score : scores) {
+                sum += score.first.size() + static_cast<std::uint64_t>(score.second);
+            }
+            return sum;
+        }, [&]() {
+            std::vector<std::pair<std::string, int>> scores;
+            for (auto& record : records) {
+                int score = average(record);
+                if (score > 80) {
+                    scores.push_back(std::make_pair(record.last_name, score));
+                }
+            }
+            std::uint64_t sum = scores.size();
+            for (auto& score : scores) {
+                sum += score.first.size() + static_cast<std::uint64_t>(score.second);
+            }
+            return sum;
+        });
+
+        compare("readme count", [&]() {
+            return static_cast<std::uint64_t>(query().count());
+        }, [&]() {
+            std::uint64_t count = 0;
+            for (auto& record : records) {
+                count += average(record) > 80;
+            }
+            return count;
+        });
+
+        compare("readme sum", [&]() {
+            return static_cast<std::uint64_t>(query().select([](const sb::let_value<record_t, int>& record) { return record.value(); }).sum());
+        }, [&]() {
+            std::uint64_t sum = 0;
+            for (auto& record : records) {
+                int score = average(record);
+                if (score > 80) {
+                    sum += static_cast<std::uint64_t>(score);
+                }
+            }
+            return sum;
+        });
+
+        compare("readme top 10", [&]() {
+            std::uint64_t sum = 0;
+            std::uint64_t rank = 0;
+            auto top = query().order_by_descending([](const sb::let_value<record_t, int>& record) { return record.value(); }).take(10);
+            for (const auto& record : top) {
+                sum += static_cast<std::uint64_t>(record.value()) * ++rank;
+            }
+            return sum;
+        }, [&]() {
+            std::vector<int> scores;
+            for (auto& record : records) {
+                int score = average(record);
+                if (score > 80) {
+                    scores.push_back(score);
+                }
+            }
+            std::size_t count = std::min<std::size_t>(10, scores.size());
+            std::partial_sort(scores.begin(), scores.begin() + count, scores.end(), [](int lhs, int rhs) { return lhs > rhs; });
+            std::uint64_t sum = 0;
+            for (std::size_t i = 0; i < count; ++i) {
+                sum += static_cast<std::uint64_t>(scores[i]) * (i + 1);
+            }
+            return sum;
+        });
+    }
+
+    /* operators keyed on the skewed class */
+    void run_keyed(void)
+    {
+        const auto& records = m_records;
+        const auto& dimension = m_classes;
+        auto class_of = [](const record_t& record) { return record.class_id; };
+
+        compare("group_by", [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& group : sb::from(records).group_by(class_of, [](const record_t& record) { return average(record); })) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second.count() + group.second.first();
+            }
+            return sum;
+        }, [&]() {
+            return grouped_loop();
+        });
+
+        compare("group_by parallel", [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& group : sb::from(records).group_by(class_of, [](const record_t& record) { return average(record); }, sb::parallel())) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second.count() + group.second.first();
+            }
+            return sum;
+        }, [&]() {
+            return grouped_loop();
+        });
+
+        compare("group_aggregate", [&]() {
+            std::uint64_t sum = 0;
+            auto groups = sb::from(records).group_aggregate(class_of, std::uint64_t(0), [](std::uint64_t state, const record_t& record) {
+                return state + static_cast<std::uint64_t>(average(record));
+            });
+            for (const auto& group : groups) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second;
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_map<int, std::uint64_t> groups;
+            for (auto& record : records) {
+                groups[record.class_id] += static_cast<std::uint64_t>(average(record));
+            }
+            std::uint64_t sum = 0;
+            for (auto& group : groups) {
+                sum += static_cast<std::uint64_t>(group.first + 1) * group.second;
+            }
+            return sum;
+        });
+
+        compare("join", [&]() {
+            std::uint64_t sum = 0;
+            auto rows = sb::from(records).join(dimension, class_of, [](const Class& row) { return row.first; });
+            for (const auto& row : rows) {
+                sum += static_cast<std::uint64_t>(average(row.second.first)) + row.second.second.second.size();
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_multimap<int, const std::string*> table;
+            for (auto& row : dimension) {
+                table.insert(std::make_pair(row.first, &row.second));
+            }
+            std::uint64_t sum = 0;
+            for (auto& record : records) {
+                auto range = table.equal_range(record.class_id);
+                for (auto it = range.first; it != range.second; ++it) {
+                    sum += static_cast<std::uint64_t>(average(record)) + it->second->size();
+                }
+            }
+            return sum;
+        });
+
+        compare("distinct", [&]() {
+            std::uint64_t sum = 0;
+            for (auto key : sb::from(records).select(class_of).distinct()) {
+                sum += static_cast<std::uint64_t>(key) + 1;
+            }
+            return sum;
+        }, [&]() {
+            std::unordered_set<int> seen;
+            for (auto& record : records) {
+                seen.insert(record.class_id);
+            }
+            std::uint64_t sum = 0;
+            for (auto key : seen) {
+                sum += static_cast<std::uint64_t>(key) + 1;
+            }
+            return sum;
+        });
+    }
+
+private:
+    /* checksum of grouping averages by class: (class + 1) * rows plus the first average of every class */
+    std::uint64_t grouped_loop(void) const
+    {
+        std::unordered_map<int, std::vector<int>> groups;
+        for (auto& record : m_records) {
+            groups[record.class_id].push_back(average(record));
+        }
+        std::uint64_t sum = 0;
+        for (auto& group : groups) {
+            sum += static_cast<std::uint64_t>(group.first + 1) * group.second.size() + group.second.front();
+        }
+        return sum;
+    }
+
+    template <typename Linq, typename Loop>
+    void compare(const char* name, const Linq& linq, const Loop& loop)
+    {
+        if (!bench::selected(name, m_filter)) {
+            return;
+        }
+
+        auto linq_result = bench::measure_latency(m_runs, linq);
+        auto loop_result = bench::measure_latency(m_runs, loop);
+        m_ok = bench::print_latency_row(name, m_skew, m_records.size(), linq_result, loop_result) && m_ok;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    std::size_t rows = argc > 1 ? static_cast<std::size_t>(std::atof(argv[1])) : 1000000;
+    std::size_t runs = argc > 2 ? static_cast<std::size_t>(std::atoi(argv[2])) : 101;
+    std::string filter = argc > 3 ? argv[3] : "";
+    bool ok = true;
+
+    if (runs < 100) {
+        std::printf("warning: %zu runs is too few for a p99, which is the slowest run below 100 runs\n", runs);
+    }
+
+    bench::print_latency_header();
+
+    for (auto skew : skews) {
+        workload scenario(rows, skew, runs ? runs : 1, filter);
+
+        if (skew == skews[0]) {
+            scenario.run_readme();
+        }
+
+        scenario.run_keyed();
+        ok = ok && scenario.ok();
+    }
+
+    std::printf("peak rss: %ld KiB\n", bench::peak_rss_kb());
+    return ok ? 0 : 1;
+}
@@ -8,13 +8,38 @@
 #include <list>
 #include <deque>
 #include <memory>
+#include <new>
 #include <numeric>
+#include <limits>
 #include <stdexcept>
 #include <exception>
 #include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <ostream>
+#include <sstream>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <tuple>
+
+#if defined(ENUMERABLE_HARDWARE_COUNTERS) && defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace sb {
 
@@ -56,879 +81,4728 @@ namespace sb {
         typedef void type;
     };
 
+    /* selectors returning references yield values */
     template <typename Class, typename Result, typename ...Args>
     struct functor_retriver<Result(Class::*)(Args...)> {
-        typedef Result type;
+        typedef typename std::decay<Result>::type type;
     };
 
     template <typename Class, typename Result, typename ...Args>
     struct functor_retriver<Result(Class::*)(Args...)const> {
-        typedef Result type;
+        typedef typename std::decay<Result>::type type;
     };
 
-    /* iterator */
     template <typename Type>
-    struct iterator_wrap {
-        class placeholder {
-        public:
-            virtual std::shared_ptr<placeholder> next(void) = 0;
-            virtual Type value(void) const = 0;
-            virtual bool equals(const std::shared_ptr<placeholder>& rhs) const = 0;
-        };
-
-        template <typename Iterator>
-        class holder : public placeholder {
-        public:
-            holder(const Iterator& iterator) :
-                m_iterator(iterator)
-            {
-            }
-
-            virtual std::shared_ptr<placeholder> next(void)
-            {
-                auto it = m_iterator;
-                it++;
-                return std::make_shared<holder<Iterator>>(it);
-            }
-
-            virtual Type value(void) const
-            {
-                return *m_iterator;
-            }
+    struct is_range {
+    private:
+        template <typename Range>
+        static auto check(int) -> decltype(std::begin(std::declval<const Range&>()), std::true_type());
 
-            virtual bool equals(const std::shared_ptr<placeholder>& rhs) const
-            {
-                auto real_rhs = std::dynamic_pointer_cast<holder<Iterator>>(rhs);
-                return m_iterator == real_rhs->m_iterator;
-            }
+        template <typename Range>
+        static std::false_type check(...);
 
-        private:
-            Iterator m_iterator;
-        };
+    public:
+        static const bool value = decltype(check<Type>(0))::value;
     };
 
+    /* a value that may be missing, returned by the try_ terminal operators */
     template <typename Type>
-    class enumerable_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    class maybe {
     private:
-        typedef enumerable_iterator<Type> Self;
+        typedef maybe<Type> Self;
 
     private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        typename std::aligned_storage<sizeof(Type), std::alignment_of<Type>::value>::type m_storage;
+        bool m_has_value;
 
     public:
-        template <typename Iterator>
-        enumerable_iterator(const Iterator& iterator) :
-            m_iterator(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(iterator))
-        {
-        }
-
-        Self& operator++()
+        maybe() : m_has_value(false)
         {
-            m_iterator = m_iterator->next();
-            return *this;
         }
 
-        Self operator++(int)
+        maybe(const Type& value) : m_has_value(true)
         {
-            auto temp = *this;
-            m_iterator = m_iterator->next();
-            return temp;
+            new (&m_storage) Type(value);
         }
 
-        Type operator*() const
+        maybe(Type&& value) : m_has_value(true)
         {
-            return m_iterator->value();
+            new (&m_storage) Type(std::move(value));
         }
 
-        bool operator==(const Self& rhs) const
+        maybe(const Self& rhs) : m_has_value(rhs.m_has_value)
         {
-            return m_iterator->equals(rhs.m_iterator);
+            if (m_has_value) {
+                new (&m_storage) Type(*rhs);
+            }
         }
 
-        bool operator!=(const Self& rhs) const
+        maybe(Self&& rhs) : m_has_value(rhs.m_has_value)
         {
-            return !m_iterator->equals(rhs.m_iterator);
+            if (m_has_value) {
+                new (&m_storage) Type(std::move(*rhs));
+            }
         }
-    };
-
-    template <typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    enumerable_iterator<Type> make_enumerable_iterator(const Iterator& iterator)
-    {
-        return enumerable_iterator<Type>(iterator);
-    }
-
-    template <typename Type>
-    class concat_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef concat_iterator<Type> Self;
-
-    private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_lhsbegin;
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_lhsend;
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_right_begin;
-        bool m_left;
 
-    public:
-        template <typename LhsIterator, typename RhsIterator>
-        concat_iterator(const LhsIterator& lhsbegin, const LhsIterator& lhsend, const RhsIterator& right_begin) :
-            m_lhsbegin(std::make_shared<typename iterator_wrap<Type>::template holder<LhsIterator>>(lhsbegin)),
-            m_lhsend(std::make_shared<typename iterator_wrap<Type>::template holder<LhsIterator>>(lhsend)),
-            m_right_begin(std::make_shared<typename iterator_wrap<Type>::template holder<RhsIterator>>(right_begin)),
-            m_left(lhsbegin != lhsend)
+        ~maybe()
         {
+            reset();
         }
 
-        Self& operator++()
+        Self& operator=(Self rhs)
         {
-            if (m_left) {
-                m_lhsbegin = m_lhsbegin->next();
-
-                if (m_lhsbegin->equals(m_lhsend)) {
-                    m_left = false;
-                }
+            reset();
 
-            } else {
-                m_right_begin = m_right_begin->next();
+            if (rhs.m_has_value) {
+                new (&m_storage) Type(std::move(*rhs));
+                m_has_value = true;
             }
 
             return *this;
         }
 
-        Self operator++(int)
+        bool has_value(void) const
         {
-            auto temp = *this;
-
-            if (m_left) {
-                m_lhsbegin = m_lhsbegin->next();
+            return m_has_value;
+        }
 
-                if (m_lhsbegin->equals(m_lhsend)) {
-                    m_left = false;
-                }
+        explicit operator bool(void) const
+        {
+            return m_has_value;
+        }
 
-            } else {
-                m_right_begin = m_right_begin->next();
-            }
+        const Type& operator*() const
+        {
+            return *reinterpret_cast<const Type*>(&m_storage);
+        }
 
-            return temp;
+        Type& operator*()
+        {
+            return *reinterpret_cast<Type*>(&m_storage);
         }
 
-        Type operator*() const
+        const Type* operator->() const
         {
-            return m_left ? m_lhsbegin->value() : m_right_begin->value();
+            return &**this;
         }
 
-        bool operator==(const Self& rhs) const
+        const Type& value(void) const
         {
-            if (m_left != rhs.m_left) {
-                return false;
+            if (!m_has_value) {
+                throw enumerable_exception("get a value from an empty collection");
             }
 
-            return m_left ? m_lhsbegin->equals(rhs.m_lhsbegin) : m_right_begin->equals(rhs.m_right_begin);
+            return **this;
         }
 
-        bool operator!=(const Self& rhs) const
+        Type value_or(const Type& value) const
         {
-            if (m_left != rhs.m_left) {
-                return true;
-            }
+            return m_has_value ? **this : value;
+        }
 
-            return m_left ? !m_lhsbegin->equals(rhs.m_lhsbegin) : !m_right_begin->equals(rhs.m_right_begin);
+        void reset(void)
+        {
+            if (m_has_value) {
+                reinterpret_cast<Type*>(&m_storage)->~Type();
+                m_has_value = false;
+            }
         }
     };
 
-    template <typename LhsIterator, typename RhsIterator, typename Type = typename recover_type<typename std::iterator_traits<LhsIterator>::value_type>::type>
-    concat_iterator<Type> make_concat_iterator(const LhsIterator& lhsbegin, const LhsIterator& lhsend, const RhsIterator& right_begin)
-    {
-        return concat_iterator<Type>(lhsbegin, lhsend, right_begin);
-    }
-
-    template <typename Container, typename Type>
-    class storage_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef storage_iterator<Container, Type> Self;
-
+    /* an element carried through a query together with a value computed from it once */
+    template <typename Type, typename Value>
+    class let_value {
     private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
-        std::shared_ptr<Container> m_owner;
+        std::shared_ptr<const Type> m_element;
+        Value m_value;
 
     public:
-        template <typename Iterator>
-        storage_iterator(const std::shared_ptr<Container>& owner, const Iterator& iterator) :
-            m_owner(owner),
-            m_iterator(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(iterator))
+        let_value(const std::shared_ptr<const Type>& element, const Value& value) :
+            m_element(element),
+            m_value(value)
         {
         }
 
-        Self& operator++()
+        const Type& element(void) const
         {
-            m_iterator = m_iterator->next();
-            return *this;
+            return *m_element;
         }
 
-        Self operator++(int)
+        const Value& value(void) const
         {
-            auto temp = *this;
-            m_iterator = m_iterator->next();
-            return temp;
+            return m_value;
         }
+    };
 
-        Type operator*() const
+    /* execution policy */
+    struct parallel_policy {
+        parallel_policy(unsigned int threads = 0, bool ordered = false) :
+            threads(threads),
+            ordered(ordered)
         {
-            return m_iterator->value();
         }
 
-        bool operator==(const Self& rhs) const
-        {
-            return m_iterator->equals(rhs.m_iterator);
-        }
+        unsigned int threads;   // worker count, 0 for std::thread::hardware_concurrency()
+        bool ordered;           // emit groups sorted by key instead of partition order
+    };
 
-        bool operator!=(const Self& rhs) const
+    inline parallel_policy parallel(unsigned int threads = 0, bool ordered = false)
+    {
+        return parallel_policy(threads, ordered);
+    }
+
+    struct spill_policy {
+        spill_policy(std::size_t budget, std::size_t partitions = 16) :
+            budget(budget),
+            partitions(partitions ? partitions : 1)
         {
-            return !m_iterator->equals(rhs.m_iterator);
         }
+
+        std::size_t budget;     // approximate bytes of partial state held in memory before spilling
+        std::size_t partitions; // temp files the spilled state is hash partitioned into
     };
 
-    template <typename Container, typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    storage_iterator<Container, Type> make_storage_iterator(const std::shared_ptr<Container>& values, const Iterator& iterator)
+    inline spill_policy spill(std::size_t budget, std::size_t partitions = 16)
     {
-        return storage_iterator<Container, Type>(values, iterator);
+        return spill_policy(budget, partitions);
     }
 
-    template <typename Type, typename Functor>
-    class select_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef select_iterator<Type, Functor> Self;
+    /* spread a key hash over count partitions independently of the hash table bucket index */
+    inline std::size_t partition_of(std::size_t hash, std::size_t count)
+    {
+        return static_cast<std::size_t>((static_cast<unsigned long long>(hash) * 0x9E3779B97F4A7C15ull) >> 32) % count;
+    }
+
+    /* accounting */
+#ifdef ENUMERABLE_ACCOUNTING
+    /* what the queries allocated for one operator stage */
+    struct allocation_stats {
+        allocation_stats(void) :
+            allocations(0),
+            bytes(0),
+            control_blocks(0)
+        {
+        }
+
+        std::size_t allocations;
+        std::size_t bytes;
+        std::size_t control_blocks;
+    };
 
+    class allocation_registry {
     private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
-        Functor m_selector;
+        std::mutex m_mutex;
+        std::map<std::string, allocation_stats> m_stages;
 
     public:
-        template <typename Iterator>
-        select_iterator(const Iterator& iterator, const Functor& selector) :
-            m_selector(selector),
-            m_iterator(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(iterator))
+        void record(const char* stage, std::size_t bytes)
         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto& stats = m_stages[stage];
+            stats.allocations++;
+            stats.bytes += bytes;
         }
 
-        Self& operator++()
+        void record_control_block(const char* stage)
         {
-            m_iterator = m_iterator->next();
-            return *this;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stages[stage].control_blocks++;
         }
 
-        Self operator++(int)
+        std::map<std::string, allocation_stats> report(void)
         {
-            auto temp = *this;
-            m_iterator = m_iterator->next();
-            return temp;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_stages;
         }
 
-        typename functor_retriver<decltype(&Functor::operator())>::type operator*() const
+        void reset(void)
         {
-            return m_selector(m_iterator->value());
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stages.clear();
         }
+    };
 
-        bool operator==(const Self& rhs) const
-        {
-            return m_iterator->equals(rhs.m_iterator);
-        }
+    inline allocation_registry& allocation_registry_instance(void)
+    {
+        static allocation_registry registry;
+        return registry;
+    }
 
-        bool operator!=(const Self& rhs) const
-        {
-            return !m_iterator->equals(rhs.m_iterator);
+    /* allocations made since the last reset, keyed by stage: "from", "where", "group_by", ... */
+    inline std::map<std::string, allocation_stats> allocation_report(void)
+    {
+        return allocation_registry_instance().report();
+    }
+
+    inline allocation_stats allocation_total(void)
+    {
+        allocation_stats total;
+
+        for (auto& stage : allocation_report()) {
+            total.allocations += stage.second.allocations;
+            total.bytes += stage.second.bytes;
+            total.control_blocks += stage.second.control_blocks;
         }
-    };
 
-    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    select_iterator<Type, Functor> make_select_iterator(const Iterator& iterator, const Functor& selector)
+        return total;
+    }
+
+    inline void reset_allocation_report(void)
     {
-        return select_iterator<Type, Functor>(iterator, selector);
+        allocation_registry_instance().reset();
     }
 
-    template <typename Type>
-    class skip_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef skip_iterator<Type> Self;
+    inline std::ostream& operator<<(std::ostream& out, const std::map<std::string, allocation_stats>& report)
+    {
+        for (auto& stage : report) {
+            out << stage.first << ": " << stage.second.allocations << " allocations, " << stage.second.bytes << " bytes, "
+                << stage.second.control_blocks << " control blocks" << std::endl;
+        }
+        return out;
+    }
 
-    private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+    inline const char*& current_stage(void)
+    {
+        static thread_local const char* stage = "query";
+        return stage;
+    }
 
+    /* std::allocator, recording what it hands out against the stage current at the time */
+    template <typename Type>
+    class counting_allocator {
     public:
-        template <typename Iterator>
-        skip_iterator(const Iterator& begin, const Iterator& end, int count)
+        typedef Type value_type;
+
+        explicit counting_allocator(const char* stage) :
+            m_stage(stage)
         {
-            Iterator it = begin;
-            for (int i = 0; i < count && it != end; i++, it++);
-            m_iterator = std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(it);
         }
 
-        Self& operator++()
+        template <typename Other>
+        counting_allocator(const counting_allocator<Other>& rhs) :
+            m_stage(rhs.stage())
         {
-            m_iterator = m_iterator->next();
-            return *this;
         }
 
-        Self operator++(int)
+        Type* allocate(std::size_t count)
         {
-            auto temp = *this;
-            m_iterator = m_iterator->next();
-            return temp;
+            allocation_registry_instance().record(m_stage, count * sizeof(Type));
+            return static_cast<Type*>(::operator new(count * sizeof(Type)));
         }
 
-        Type operator*() const
+        void deallocate(Type* pointer, std::size_t)
         {
-            return m_iterator->value();
+            ::operator delete(pointer);
         }
 
-        bool operator==(const Self& rhs) const
+        const char* stage(void) const
         {
-            return m_iterator->equals(rhs.m_iterator);
+            return m_stage;
         }
 
-        bool operator!=(const Self& rhs) const
+        template <typename Other>
+        bool operator==(const counting_allocator<Other>&) const
         {
-            return !m_iterator->equals(rhs.m_iterator);
+            return true;
         }
-    };
-
-    template <typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    skip_iterator<Type> make_skip_iterator(const Iterator& begin, const Iterator& end, int count)
-    {
-        return skip_iterator<Type>(begin, end, count);
-    }
 
-    template <typename Type, typename Functor>
-    class skip_while_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef skip_while_iterator<Type, Functor> Self;
+        template <typename Other>
+        bool operator!=(const counting_allocator<Other>&) const
+        {
+            return false;
+        }
 
     private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        const char* m_stage;
+    };
+#endif
 
+    /* names the operator stage the allocations made while it lives are charged to, when accounting */
+    class stage_scope {
     public:
-        template <typename Iterator>
-        skip_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate)
+#ifdef ENUMERABLE_ACCOUNTING
+        explicit stage_scope(const char* stage) :
+            m_previous(current_stage())
         {
-            Iterator it = begin;
-            for (; it != end && predicate(*it); ++it);
-            m_iterator = std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(it);
+            if (stage) {
+                current_stage() = stage;
+            }
         }
 
-        Self& operator++()
+        ~stage_scope()
         {
-            m_iterator = m_iterator->next();
-            return *this;
+            current_stage() = m_previous;
         }
 
-        Self operator++(int)
+        static const char* current(void)
         {
-            auto temp = *this;
-            m_iterator = m_iterator->next();
-            return temp;
+            return current_stage();
         }
-
-        Type operator*() const
+#else
+        explicit stage_scope(const char*)
         {
-            return m_iterator->value();
         }
 
-        bool operator==(const Self& rhs) const
+        static const char* current(void)
         {
-            return m_iterator->equals(rhs.m_iterator);
+            return nullptr;
         }
+#endif
 
-        bool operator!=(const Self& rhs) const
-        {
-            return !m_iterator->equals(rhs.m_iterator);
-        }
+    private:
+        stage_scope(const stage_scope&);
+        stage_scope& operator=(const stage_scope&);
+
+#ifdef ENUMERABLE_ACCOUNTING
+        const char* m_previous;
+#endif
     };
 
-    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    skip_while_iterator<Type, Functor> make_skip_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate)
+    /* std::make_shared, charging the object and its control block to the current stage when accounting */
+    template <typename Type, typename... Args>
+    std::shared_ptr<Type> make_counted(Args&&... args)
     {
-        return skip_while_iterator<Type, Functor>(begin, end, predicate);
+#ifdef ENUMERABLE_ACCOUNTING
+        allocation_registry_instance().record_control_block(current_stage());
+        return std::allocate_shared<Type>(counting_allocator<Type>(current_stage()), std::forward<Args>(args)...);
+#else
+        return std::make_shared<Type>(std::forward<Args>(args)...);
+#endif
+    }
+
+    /* tracing */
+    /*
+     * records a complete event for every operator phase run while it is installed with a
+     * trace_scope, from any thread, and writes them as Chrome trace event JSON, which
+     * chrome://tracing and ui.perfetto.dev open
+     */
+    class trace_recorder {
+    public:
+        struct event {
+            std::string name;
+            std::uint64_t begin;    // ns since the recorder was created
+            std::uint64_t end;
+            unsigned int thread;
+            std::vector<std::pair<const char*, std::uint64_t>> args;
+        };
+
+        trace_recorder(void) :
+            m_epoch(std::chrono::steady_clock::now())
+        {
+        }
+
+        std::uint64_t now(void) const
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count());
+        }
+
+        void record(const std::string& name, std::uint64_t begin, std::uint64_t end, const std::vector<std::pair<const char*, std::uint64_t>>& args)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto thread = m_threads.insert(std::make_pair(std::this_thread::get_id(), static_cast<unsigned int>(m_threads.size() + 1))).first->second;
+            event recorded = { name, begin, end, thread, args };
+            m_events.push_back(recorded);
+        }
+
+        std::vector<event> events(void) const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_events;
+        }
+
+        void clear(void)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_events.clear();
+        }
+
+        void write(std::ostream& out) const
+        {
+            char number[64];
+            bool first = true;
+
+            out << "{\"traceEvents\":[";
+
+            for (auto& recorded : events()) {
+                out << (first ? "\n" : ",\n") << "{\"name\":\"";
+                escape(out, recorded.name);
+                std::snprintf(number, sizeof(number), "%.3f", recorded.begin / 1000.0);
+                out << "\",\"cat\":\"linq\",\"ph\":\"X\",\"pid\":1,\"tid\":" << recorded.thread << ",\"ts\":" << number;
+                std::snprintf(number, sizeof(number), "%.3f", (recorded.end - recorded.begin) / 1000.0);
+                out << ",\"dur\":" << number << ",\"args\":{";
+
+                for (std::size_t i = 0; i < recorded.args.size(); ++i) {
+                    out << (i ? "," : "") << "\"" << recorded.args[i].first << "\":" << recorded.args[i].second;
+                }
+
+                out << "}}";
+                first = false;
+            }
+
+            out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        }
+
+        /* write the trace to path, throws enumerable_exception if it cannot be written */
+        void write(const std::string& path) const
+        {
+            std::ostringstream out;
+            write(out);
+
+            auto text = out.str();
+            std::FILE* file = std::fopen(path.c_str(), "wb");
+
+            if (!file) {
+                throw enumerable_exception("cannot open the trace file");
+            }
+
+            bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+
+            if (std::fclose(file) != 0 || !written) {
+                throw enumerable_exception("cannot write the trace file");
+            }
+        }
+
+        /* the recorder queries report to, from every thread, null when tracing is off */
+        static std::atomic<trace_recorder*>& current(void)
+        {
+            static std::atomic<trace_recorder*> recorder(nullptr);
+            return recorder;
+        }
+
+    private:
+        trace_recorder(const trace_recorder&);
+        trace_recorder& operator=(const trace_recorder&);
+
+        static void escape(std::ostream& out, const std::string& text)
+        {
+            for (auto c : text) {
+                if (c == '"' || c == '\\') {
+                    out << '\\';
+                }
+                out << c;
+            }
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_epoch;
+        mutable std::mutex m_mutex;
+        std::vector<event> m_events;
+        std::map<std::thread::id, unsigned int> m_threads;
+    };
+
+    /* makes recorder receive the phases of every query run, on any thread, while the scope lives */
+    class trace_scope {
+    private:
+        trace_recorder* m_previous;
+
+    public:
+        explicit trace_scope(trace_recorder& recorder) :
+            m_previous(trace_recorder::current().exchange(&recorder))
+        {
+        }
+
+        ~trace_scope()
+        {
+            trace_recorder::current().store(m_previous);
+        }
+
+    private:
+        trace_scope(const trace_scope&);
+        trace_scope& operator=(const trace_scope&);
+    };
+
+    /* one phase of an operator, from construction to end() or destruction; free when tracing is off */
+    class trace_span {
+    public:
+        trace_span(const char* stage, const char* phase) :
+            m_recorder(trace_recorder::current().load(std::memory_order_acquire)),
+            m_stage(stage),
+            m_phase(phase),
+            m_begin(m_recorder ? m_recorder->now() : 0)
+        {
+        }
+
+        ~trace_span()
+        {
+            end();
+        }
+
+        /* attach a count to the event, shown as an argument in the trace viewer */
+        void arg(const char* key, std::uint64_t value)
+        {
+            if (m_recorder) {
+                m_args.push_back(std::make_pair(key, value));
+            }
+        }
+
+        void end(void)
+        {
+            if (m_recorder) {
+                m_recorder->record(std::string(m_stage) + " " + m_phase, m_begin, m_recorder->now(), m_args);
+                m_recorder = nullptr;
+            }
+        }
+
+    private:
+        trace_span(const trace_span&);
+        trace_span& operator=(const trace_span&);
+
+    private:
+        trace_recorder* m_recorder;
+        const char* m_stage;
+        const char* m_phase;
+        std::uint64_t m_begin;
+        std::vector<std::pair<const char*, std::uint64_t>> m_args;
+    };
+
+    /* run task(0) .. task(count - 1) on their own threads, charged to the caller's stage, rethrow the first failure */
+    template <typename Functor>
+    void parallel_for(std::size_t count, const Functor& task)
+    {
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(count);
+        const char* stage = stage_scope::current();
+
+        for (std::size_t i = 1; i < count; ++i) {
+            threads.push_back(std::thread([&task, &errors, stage, i]() {
+                stage_scope scope(stage);
+
+                try {
+                    task(i);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }));
+        }
+
+        if (count > 0) {
+            try {
+                task(0);
+            } catch (...) {
+                errors[0] = std::current_exception();
+            }
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    /* memory */
+    class memory_resource {
+    public:
+        virtual ~memory_resource()
+        {
+        }
+
+        void* allocate(std::size_t bytes, std::size_t alignment)
+        {
+#ifdef ENUMERABLE_ACCOUNTING
+            allocation_registry_instance().record(current_stage(), bytes);
+#endif
+            return do_allocate(bytes, alignment);
+        }
+
+        void deallocate(void* pointer, std::size_t bytes, std::size_t alignment)
+        {
+            do_deallocate(pointer, bytes, alignment);
+        }
+
+    protected:
+        virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+        virtual void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) = 0;
+    };
+
+    class new_delete_resource : public memory_resource {
+    protected:
+        virtual void* do_allocate(std::size_t bytes, std::size_t)
+        {
+            return ::operator new(bytes);
+        }
+
+        virtual void do_deallocate(void* pointer, std::size_t, std::size_t)
+        {
+            ::operator delete(pointer);
+        }
+    };
+
+    /*
+     * hands out memory from a growing list of chunks and frees nothing until it is destroyed,
+     * so the nodes of a materialized result cost a pointer bump and are released in one shot
+     */
+    class monotonic_resource : public memory_resource {
+    private:
+        std::mutex m_mutex;
+        std::vector<void*> m_chunks;
+        char* m_current;
+        std::size_t m_remaining;
+        std::size_t m_next_size;
+
+    public:
+        explicit monotonic_resource(std::size_t initial_size = 4096) :
+            m_current(nullptr),
+            m_remaining(0),
+            m_next_size(initial_size ? initial_size : 4096)
+        {
+        }
+
+        virtual ~monotonic_resource()
+        {
+            release();
+        }
+
+        void release(void)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            for (auto chunk : m_chunks) {
+                ::operator delete(chunk);
+            }
+
+            m_chunks.clear();
+            m_current = nullptr;
+            m_remaining = 0;
+        }
+
+    protected:
+        virtual void* do_allocate(std::size_t bytes, std::size_t alignment)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::size_t padding = m_current ? (alignment - reinterpret_cast<std::size_t>(m_current) % alignment) % alignment : 0;
+
+            if (!m_current || padding + bytes > m_remaining) {
+                std::size_t size = std::max(m_next_size, bytes + alignment);
+                m_chunks.push_back(::operator new(size));
+                m_current = static_cast<char*>(m_chunks.back());
+                m_remaining = size;
+                m_next_size = size * 2;
+                padding = (alignment - reinterpret_cast<std::size_t>(m_current) % alignment) % alignment;
+            }
+
+            void* result = m_current + padding;
+            m_current += padding + bytes;
+            m_remaining -= padding + bytes;
+            return result;
+        }
+
+        virtual void do_deallocate(void*, std::size_t, std::size_t)
+        {
+        }
+    };
+
+    inline std::shared_ptr<memory_resource> default_resource(void)
+    {
+        static std::shared_ptr<memory_resource> resource = std::make_shared<new_delete_resource>();
+        return resource;
+    }
+
+    inline std::shared_ptr<memory_resource>& scoped_resource(void)
+    {
+        static thread_local std::shared_ptr<memory_resource> resource;
+        return resource;
+    }
+
+    /* the resource materializing operators built on this thread allocate from */
+    inline std::shared_ptr<memory_resource> current_resource(void)
+    {
+        auto& resource = scoped_resource();
+        return resource ? resource : default_resource();
+    }
+
+    /* makes resource current for the queries built on this thread while the scope lives */
+    class resource_scope {
+    private:
+        std::shared_ptr<memory_resource> m_previous;
+
+    public:
+        explicit resource_scope(const std::shared_ptr<memory_resource>& resource) :
+            m_previous(scoped_resource())
+        {
+            scoped_resource() = resource;
+        }
+
+        ~resource_scope()
+        {
+            scoped_resource() = m_previous;
+        }
+
+    private:
+        resource_scope(const resource_scope&);
+        resource_scope& operator=(const resource_scope&);
+    };
+
+    /* allocator over a shared memory_resource; whatever is allocated keeps the resource alive */
+    template <typename Type>
+    class arena_allocator {
+    public:
+        typedef Type value_type;
+
+    private:
+        template <typename Other>
+        friend class arena_allocator;
+
+        std::shared_ptr<memory_resource> m_resource;
+
+    public:
+        explicit arena_allocator(const std::shared_ptr<memory_resource>& resource) :
+            m_resource(resource)
+        {
+        }
+
+        template <typename Other>
+        arena_allocator(const arena_allocator<Other>& rhs) :
+            m_resource(rhs.m_resource)
+        {
+        }
+
+        Type* allocate(std::size_t count)
+        {
+            return static_cast<Type*>(m_resource->allocate(count * sizeof(Type), std::alignment_of<Type>::value));
+        }
+
+        void deallocate(Type* pointer, std::size_t count)
+        {
+            m_resource->deallocate(pointer, count * sizeof(Type), std::alignment_of<Type>::value);
+        }
+
+        const std::shared_ptr<memory_resource>& resource(void) const
+        {
+            return m_resource;
+        }
+
+        template <typename Other>
+        bool operator==(const arena_allocator<Other>& rhs) const
+        {
+            return m_resource == rhs.m_resource;
+        }
+
+        template <typename Other>
+        bool operator!=(const arena_allocator<Other>& rhs) const
+        {
+            return m_resource != rhs.m_resource;
+        }
+    };
+
+    template <typename Type>
+    using arena_vector = std::vector<Type, arena_allocator<Type>>;
+
+    /* an empty container, and its control block, allocated from resource; args follow the allocator */
+    template <typename Container, typename... Args>
+    std::shared_ptr<Container> make_arena_shared(const std::shared_ptr<memory_resource>& resource, Args&&... args)
+    {
+        typedef typename Container::allocator_type Allocator;
+#ifdef ENUMERABLE_ACCOUNTING
+        allocation_registry_instance().record_control_block(current_stage());
+#endif
+        return std::allocate_shared<Container>(arena_allocator<Container>(resource), Allocator(resource), std::forward<Args>(args)...);
+    }
+
+    /* hashing */
+    inline std::size_t hash_combine(std::size_t seed, std::size_t hash)
+    {
+        return seed ^ (hash + static_cast<std::size_t>(0x9E3779B97F4A7C15ull) + (seed << 6) + (seed >> 2));
+    }
+
+    /* std::hash, extended to the pairs, tuples and vectors that keys are commonly built from */
+    template <typename Type>
+    struct hasher {
+        std::size_t operator()(const Type& value) const
+        {
+            return std::hash<Type>()(value);
+        }
+    };
+
+    template <typename First, typename Second>
+    struct hasher<std::pair<First, Second>> {
+        std::size_t operator()(const std::pair<First, Second>& value) const
+        {
+            return hash_combine(hasher<First>()(value.first), hasher<Second>()(value.second));
+        }
+    };
+
+    template <std::size_t Index, typename Tuple>
+    struct tuple_hasher {
+        static std::size_t hash(const Tuple& value)
+        {
+            typedef typename std::tuple_element<Index - 1, Tuple>::type Element;
+            return hash_combine(tuple_hasher<Index - 1, Tuple>::hash(value), hasher<Element>()(std::get<Index - 1>(value)));
+        }
+    };
+
+    template <typename Tuple>
+    struct tuple_hasher<0, Tuple> {
+        static std::size_t hash(const Tuple&)
+        {
+            return 0;
+        }
+    };
+
+    template <typename... Types>
+    struct hasher<std::tuple<Types...>> {
+        std::size_t operator()(const std::tuple<Types...>& value) const
+        {
+            return tuple_hasher<sizeof...(Types), std::tuple<Types...>>::hash(value);
+        }
+    };
+
+    template <typename Type, typename Allocator>
+    struct hasher<std::vector<Type, Allocator>> {
+        std::size_t operator()(const std::vector<Type, Allocator>& value) const
+        {
+            std::size_t seed = value.size();
+
+            for (auto& element : value) {
+                seed = hash_combine(seed, hasher<Type>()(element));
+            }
+
+            return seed;
+        }
+    };
+
+    /* transparent ==, so a table can be probed with anything comparable to its keys */
+    struct key_equal {
+        template <typename Left, typename Right>
+        bool operator()(const Left& lhs, const Right& rhs) const
+        {
+            return lhs == rhs;
+        }
+    };
+
+    /* hash and equality the set, grouping and join operators use in place of sb::hasher and == */
+    template <typename Hash, typename Equal>
+    struct hash_policy {
+        hash_policy(const Hash& hash, const Equal& equal) :
+            hash(hash),
+            equal(equal)
+        {
+        }
+
+        Hash hash;
+        Equal equal;
+    };
+
+    template <typename Hash, typename Equal>
+    inline hash_policy<Hash, Equal> hashing(const Hash& hash, const Equal& equal)
+    {
+        return hash_policy<Hash, Equal>(hash, equal);
+    }
+
+    template <typename Hash>
+    inline hash_policy<Hash, key_equal> hashing(const Hash& hash)
+    {
+        return hash_policy<Hash, key_equal>(hash, key_equal());
+    }
+
+    /* flat table */
+    struct identity_key {
+        template <typename Entry>
+        static const Entry& get(const Entry& entry)
+        {
+            return entry;
+        }
+    };
+
+    struct first_key {
+        template <typename Entry>
+        static const typename Entry::first_type& get(const Entry& entry)
+        {
+            return entry.first;
+        }
+    };
+
+    /*
+     * open addressing hash table kept as two flat arrays: the entries, dense and in insertion
+     * order, and a power of two slot array of (hash tag, entry index) probed linearly. a probe
+     * walks a few adjacent 8 byte slots and compares keys only on a tag match; the full hash of
+     * every entry is stored so growing never calls the hash functor again. there is no erase,
+     * the operators only ever add keys, and iteration yields keys in the order first seen
+     */
+    template <typename Entry, typename Key, typename KeyOf, typename Hash, typename Equal>
+    class flat_table {
+    public:
+        typedef Entry value_type;
+        typedef arena_allocator<Entry> allocator_type;
+        typedef typename arena_vector<Entry>::iterator iterator;
+        typedef typename arena_vector<Entry>::const_iterator const_iterator;
+
+    private:
+        struct slot {
+            std::uint32_t tag;
+            std::uint32_t index; // entry index + 1, 0 while the slot is empty
+        };
+
+        arena_vector<Entry> m_entries;
+        arena_vector<std::size_t> m_hashes;
+        arena_vector<slot> m_slots;
+        std::size_t m_shift;
+        Hash m_hash;
+        Equal m_equal;
+
+    public:
+        explicit flat_table(const allocator_type& allocator = allocator_type(default_resource()),
+                            const Hash& hash = Hash(),
+                            const Equal& equal = Equal()) :
+            m_entries(allocator),
+            m_hashes(arena_allocator<std::size_t>(allocator)),
+            m_slots(arena_allocator<slot>(allocator)),
+            m_shift(64),
+            m_hash(hash),
+            m_equal(equal)
+        {
+        }
+
+        iterator begin(void)
+        {
+            return m_entries.begin();
+        }
+
+        const_iterator begin(void) const
+        {
+            return m_entries.begin();
+        }
+
+        bool empty(void) const
+        {
+            return m_entries.empty();
+        }
+
+        iterator end(void)
+        {
+            return m_entries.end();
+        }
+
+        const_iterator end(void) const
+        {
+            return m_entries.end();
+        }
+
+        /* the entry holding key, nullptr when there is none; key may be any type Hash and Equal take */
+        template <typename Lookup>
+        Entry* find(const Lookup& key)
+        {
+            if (m_entries.empty()) {
+                return nullptr;
+            }
+
+            std::size_t hash = m_hash(key);
+            const slot& found = m_slots[probe(key, hash)];
+            return found.index ? &m_entries[found.index - 1] : nullptr;
+        }
+
+        /* the entry holding key, appending factory() when there is none; second tells which */
+        template <typename Factory>
+        std::pair<Entry*, bool> find_or_insert(const Key& key, const Factory& factory)
+        {
+            if ((m_entries.size() + 1) * 4 > m_slots.size() * 3) {
+                grow();
+            }
+
+            std::size_t hash = m_hash(key);
+            slot& found = m_slots[probe(key, hash)];
+
+            if (found.index) {
+                return std::make_pair(&m_entries[found.index - 1], false);
+            }
+
+            if (m_entries.size() >= 0xFFFFFFFFu) {
+                throw enumerable_exception("too many keys for a flat table");
+            }
+
+            m_entries.push_back(factory());
+            m_hashes.push_back(hash);
+            found.tag = tag_of(hash);
+            found.index = static_cast<std::uint32_t>(m_entries.size());
+            return std::make_pair(&m_entries.back(), true);
+        }
+
+        std::pair<Entry*, bool> insert(const Entry& entry)
+        {
+            return find_or_insert(KeyOf::get(entry), [&entry]() { return entry; });
+        }
+
+        std::pair<Entry*, bool> insert(Entry&& entry)
+        {
+            return find_or_insert(KeyOf::get(entry), [&entry]() { return std::move(entry); });
+        }
+
+        void reserve(std::size_t count)
+        {
+            m_entries.reserve(count);
+            m_hashes.reserve(count);
+
+            while (count * 4 > m_slots.size() * 3) {
+                grow();
+            }
+        }
+
+        std::size_t size(void) const
+        {
+            return m_entries.size();
+        }
+
+    private:
+        static std::uint32_t tag_of(std::size_t hash)
+        {
+            return static_cast<std::uint32_t>(hash);
+        }
+
+        std::size_t home_of(std::size_t hash) const
+        {
+            return static_cast<std::size_t>((static_cast<unsigned long long>(hash) * 0x9E3779B97F4A7C15ull) >> m_shift);
+        }
+
+        /* slot holding key, or the empty slot it would go to */
+        template <typename Lookup>
+        std::size_t probe(const Lookup& key, std::size_t hash) const
+        {
+            std::size_t mask = m_slots.size() - 1;
+            std::uint32_t tag = tag_of(hash);
+
+            for (std::size_t position = home_of(hash);; position = (position + 1) & mask) {
+                const slot& current = m_slots[position];
+
+                if (!current.index) {
+                    return position;
+                }
+
+                if (current.tag == tag && m_equal(KeyOf::get(m_entries[current.index - 1]), key)) {
+                    return position;
+                }
+            }
+        }
+
+        void grow(void)
+        {
+            std::size_t capacity = m_slots.empty() ? 16 : m_slots.size() * 2;
+            std::size_t mask = capacity - 1;
+            slot empty = { 0, 0 };
+
+            m_slots.assign(capacity, empty);
+            m_shift = 64;
+
+            for (std::size_t size = capacity; size > 1; size >>= 1) {
+                m_shift--;
+            }
+
+            for (std::size_t i = 0; i < m_entries.size(); ++i) {
+                std::size_t position = home_of(m_hashes[i]);
+
+                while (m_slots[position].index) {
+                    position = (position + 1) & mask;
+                }
+
+                m_slots[position].tag = tag_of(m_hashes[i]);
+                m_slots[position].index = static_cast<std::uint32_t>(i + 1);
+            }
+        }
+    };
+
+    template <typename Key, typename Hash = hasher<Key>, typename Equal = std::equal_to<Key>>
+    using flat_set = flat_table<Key, Key, identity_key, Hash, Equal>;
+
+    template <typename Key, typename Value, typename Hash = hasher<Key>, typename Equal = std::equal_to<Key>>
+    using flat_map = flat_table<std::pair<Key, Value>, Key, first_key, Hash, Equal>;
+
+    /* string keys */
+    /* a non-owning view of characters, the C++11 stand-in for std::string_view */
+    class string_ref {
+    private:
+        const char* m_data;
+        std::size_t m_size;
+
+    public:
+        string_ref(void) :
+            m_data(nullptr),
+            m_size(0)
+        {
+        }
+
+        string_ref(const char* data) :
+            m_data(data),
+            m_size(data ? std::strlen(data) : 0)
+        {
+        }
+
+        string_ref(const char* data, std::size_t size) :
+            m_data(data),
+            m_size(size)
+        {
+        }
+
+        string_ref(const std::string& value) :
+            m_data(value.data()),
+            m_size(value.size())
+        {
+        }
+
+        const char* begin(void) const
+        {
+            return m_data;
+        }
+
+        int compare(const string_ref& rhs) const
+        {
+            int result = std::char_traits<char>::compare(m_data, rhs.m_data, std::min(m_size, rhs.m_size));
+            return result ? result : (m_size < rhs.m_size ? -1 : (m_size > rhs.m_size ? 1 : 0));
+        }
+
+        const char* data(void) const
+        {
+            return m_data;
+        }
+
+        bool empty(void) const
+        {
+            return m_size == 0;
+        }
+
+        const char* end(void) const
+        {
+            return m_data + m_size;
+        }
+
+        std::size_t size(void) const
+        {
+            return m_size;
+        }
+
+        std::string str(void) const
+        {
+            return std::string(m_data, m_size);
+        }
+
+        explicit operator std::string(void) const
+        {
+            return str();
+        }
+
+        char operator[](std::size_t index) const
+        {
+            return m_data[index];
+        }
+    };
+
+    inline bool operator==(const string_ref& lhs, const string_ref& rhs)
+    {
+        return lhs.size() == rhs.size() && std::char_traits<char>::compare(lhs.data(), rhs.data(), lhs.size()) == 0;
+    }
+
+    inline bool operator!=(const string_ref& lhs, const string_ref& rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    inline bool operator<(const string_ref& lhs, const string_ref& rhs)
+    {
+        return lhs.compare(rhs) < 0;
+    }
+
+    inline bool operator>(const string_ref& lhs, const string_ref& rhs)
+    {
+        return rhs < lhs;
+    }
+
+    inline bool operator<=(const string_ref& lhs, const string_ref& rhs)
+    {
+        return !(rhs < lhs);
+    }
+
+    inline bool operator>=(const string_ref& lhs, const string_ref& rhs)
+    {
+        return !(lhs < rhs);
+    }
+
+    inline std::ostream& operator<<(std::ostream& stream, const string_ref& value)
+    {
+        return stream.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    /* 64 bit FNV-1a */
+    template <>
+    struct hasher<string_ref> {
+        std::size_t operator()(const string_ref& value) const
+        {
+            unsigned long long hash = 0xCBF29CE484222325ull;
+
+            for (auto c : value) {
+                hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+            }
+
+            return static_cast<std::size_t>(hash);
+        }
+    };
+
+    /*
+     * copies every distinct string once into chunks that never move and numbers the strings
+     * densely in the order first seen, so repeated keys become a small id or a stable view.
+     * views and ids live as long as the pool; it is not synchronized
+     */
+    class intern_pool {
+    private:
+        flat_map<string_ref, std::uint32_t> m_ids;
+        std::vector<string_ref> m_strings;
+        std::vector<std::unique_ptr<char[]>> m_chunks;
+        char* m_current;
+        std::size_t m_remaining;
+
+    public:
+        intern_pool(void) :
+            m_current(nullptr),
+            m_remaining(0)
+        {
+        }
+
+        /* dense id of value, interning it when it is new */
+        std::uint32_t id(const string_ref& value)
+        {
+            auto hit = m_ids.find_or_insert(value, [this, &value]() {
+                return std::make_pair(store(value), static_cast<std::uint32_t>(m_strings.size()));
+            });
+
+            if (hit.second) {
+                m_strings.push_back(hit.first->first);
+            }
+
+            return hit.first->second;
+        }
+
+        std::size_t size(void) const
+        {
+            return m_strings.size();
+        }
+
+        /* the interned copy of value */
+        string_ref view(const string_ref& value)
+        {
+            return m_strings[id(value)];
+        }
+
+        const string_ref& operator[](std::uint32_t id) const
+        {
+            return m_strings[id];
+        }
+
+    private:
+        string_ref store(const string_ref& value)
+        {
+            /* nothing to copy, and no chunk may exist yet to point into */
+            if (value.size() == 0) {
+                return string_ref();
+            }
+
+            if (value.size() > m_remaining) {
+                std::size_t size = std::max<std::size_t>(4096, value.size());
+                m_chunks.push_back(std::unique_ptr<char[]>(new char[size]));
+                m_current = m_chunks.back().get();
+                m_remaining = size;
+            }
+
+            std::char_traits<char>::copy(m_current, value.data(), value.size());
+            string_ref result(m_current, value.size());
+            m_current += value.size();
+            m_remaining -= value.size();
+            return result;
+        }
+
+        intern_pool(const intern_pool&);
+        intern_pool& operator=(const intern_pool&);
+    };
+
+    /* a pointer to container that also keeps owner alive */
+    template <typename Container, typename Owner>
+    std::shared_ptr<Container> keep_alive(const std::shared_ptr<Container>& container, const Owner& owner)
+    {
+        auto both = make_counted<std::pair<std::shared_ptr<Container>, Owner>>(container, owner);
+        return std::shared_ptr<Container>(both, container.get());
+    }
+
+    /*
+     * how the grouping and join operators hold on to keys: ordinary keys are stored as they are,
+     * string_ref keys are interned once per distinct key into a pool the result keeps alive
+     */
+    template <typename Key>
+    struct key_store {
+        static const bool view = false;
+
+        const Key& keep(const Key& key) const
+        {
+            return key;
+        }
+
+        template <typename Container>
+        std::shared_ptr<Container> attach(const std::shared_ptr<Container>& container) const
+        {
+            return container;
+        }
+
+        template <typename Container, typename Owner>
+        static std::shared_ptr<Container> attach(const std::shared_ptr<Container>& container, const Owner&)
+        {
+            return container;
+        }
+    };
+
+    template <>
+    struct key_store<string_ref> {
+        static const bool view = true;
+
+        std::shared_ptr<intern_pool> pool;
+
+        key_store(void) :
+            pool(make_counted<intern_pool>())
+        {
+        }
+
+        string_ref keep(const string_ref& key) const
+        {
+            return pool->view(key);
+        }
+
+        template <typename Container>
+        std::shared_ptr<Container> attach(const std::shared_ptr<Container>& container) const
+        {
+            return keep_alive(container, pool);
+        }
+
+        template <typename Container, typename Owner>
+        static std::shared_ptr<Container> attach(const std::shared_ptr<Container>& container, const Owner& owner)
+        {
+            return keep_alive(container, owner);
+        }
+    };
+
+    /* the key type a standalone map returned to the caller stores */
+    template <typename Key>
+    struct owned_key {
+        typedef Key type;
+    };
+
+    template <>
+    struct owned_key<string_ref> {
+        typedef std::string type;
+    };
+
+    /* plan */
+    template <typename Type>
+    class enumerable;
+
+    /* one operator of a query and the operators it reads from, as explain() and profile() show it */
+    class plan_node {
+    public:
+        plan_node(const std::string& name, const std::vector<std::shared_ptr<const plan_node>>& inputs) :
+            m_name(name),
+            m_inputs(inputs)
+        {
+        }
+
+        const std::string& name(void) const
+        {
+            return m_name;
+        }
+
+        const std::vector<std::shared_ptr<const plan_node>>& inputs(void) const
+        {
+            return m_inputs;
+        }
+
+    private:
+        std::string m_name;
+        std::vector<std::shared_ptr<const plan_node>> m_inputs;
+    };
+
+    /*
+     * cycles, instructions, L1D read misses, last level cache misses and branch misses of the
+     * calling thread, counted in user space through perf_event_open. compiled in only with
+     * ENUMERABLE_HARDWARE_COUNTERS on linux, so the header pulls in no system headers otherwise;
+     * any counter the kernel, the hardware or perf_event_paranoid refuses reads as unavailable
+     */
+    class hardware_counters {
+    public:
+        enum event {
+            cycles,
+            instructions,
+            l1d_misses,
+            llc_misses,
+            branch_misses,
+            events
+        };
+
+        typedef std::uint64_t values[events];
+
+        hardware_counters(void) :
+            m_leader(-1),
+            m_opened(0)
+        {
+            for (int i = 0; i < events; ++i) {
+                m_fds[i] = -1;
+                m_slots[i] = -1;
+            }
+
+            open();
+        }
+
+        ~hardware_counters()
+        {
+            close();
+        }
+
+        static const char* name(int counter)
+        {
+            static const char* names[events] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+            return names[counter];
+        }
+
+        bool available(void) const
+        {
+            return m_opened > 0;
+        }
+
+        bool available(int counter) const
+        {
+            return m_slots[counter] >= 0;
+        }
+
+        /* why counters are missing, empty when all of them opened */
+        const std::string& status(void) const
+        {
+            return m_status;
+        }
+
+        /* the running totals of every available counter, 0 for the others */
+        bool read(values& totals) const
+        {
+            std::fill(totals, totals + events, std::uint64_t(0));
+#if defined(ENUMERABLE_HARDWARE_COUNTERS) && defined(__linux__)
+            std::uint64_t buffer[1 + events];
+
+            if (!available() || ::read(m_leader, buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(std::uint64_t) * (1 + m_opened))) {
+                return false;
+            }
+
+            for (int i = 0; i < events; ++i) {
+                if (m_slots[i] >= 0) {
+                    totals[i] = buffer[1 + m_slots[i]];
+                }
+            }
+
+            return true;
+#else
+            return false;
+#endif
+        }
+
+    private:
+        hardware_counters(const hardware_counters&);
+        hardware_counters& operator=(const hardware_counters&);
+
+        void open(void)
+        {
+#if defined(ENUMERABLE_HARDWARE_COUNTERS) && defined(__linux__)
+            const std::uint32_t types[events] = {
+                PERF_TYPE_HARDWARE,
+                PERF_TYPE_HARDWARE,
+                PERF_TYPE_HW_CACHE,
+                PERF_TYPE_HARDWARE,
+                PERF_TYPE_HARDWARE
+            };
+            const std::uint64_t configs[events] = {
+                PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+                PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_MISSES
+            };
+
+            for (int i = 0; i < events; ++i) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = types[i];
+                attr.config = configs[i];
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.disabled = m_leader < 0 ? 1 : 0;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+
+                int fd = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, m_leader, 0));
+
+                if (fd < 0) {
+                    m_status += std::string(m_status.empty() ? "" : ", ") + name(i) + ": " + std::strerror(errno);
+                    continue;
+                }
+
+                if (m_leader < 0) {
+                    m_leader = fd;
+                }
+
+                m_fds[i] = fd;
+                m_slots[i] = m_opened++;
+            }
+
+            if (available()) {
+                ::ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ::ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+#else
+            m_status = "hardware counters need ENUMERABLE_HARDWARE_COUNTERS and linux perf_event_open";
+#endif
+        }
+
+        void close(void)
+        {
+#if defined(ENUMERABLE_HARDWARE_COUNTERS) && defined(__linux__)
+            for (int i = events - 1; i >= 0; --i) {
+                if (m_fds[i] >= 0) {
+                    ::close(m_fds[i]);
+                }
+            }
+#endif
+        }
+
+    private:
+        int m_fds[events];
+        int m_slots[events];    // position of each counter in a group read, -1 if it did not open
+        int m_leader;
+        int m_opened;
+        std::string m_status;
+    };
+
+    /* profile() also samples hardware counters per stage */
+    struct hardware_policy {
+    };
+
+    inline hardware_policy hardware(void)
+    {
+        return hardware_policy();
+    }
+
+    /* what one stage did while profile() drained its query */
+    struct stage_profile {
+        stage_profile(void) :
+            depth(0),
+            elements_in(0),
+            elements_out(0),
+            invocations(0),
+            nanoseconds(0),
+            self_nanoseconds(0)
+        {
+            std::fill(events, events + hardware_counters::events, std::uint64_t(0));
+            std::fill(self_events, self_events + hardware_counters::events, std::uint64_t(0));
+        }
+
+        std::string name;
+        int depth;                          // distance from the last operator of the query
+        std::uint64_t elements_in;          // elements its inputs handed out
+        std::uint64_t elements_out;         // elements it handed out
+        std::uint64_t invocations;          // predicate, selector and key selector calls
+        std::uint64_t nanoseconds;          // wall time, including the stages it reads from
+        std::uint64_t self_nanoseconds;     // wall time, excluding them
+        hardware_counters::values events;       // hardware counters, including the stages it reads from
+        hardware_counters::values self_events;  // hardware counters, excluding them
+    };
+
+    struct query_profile {
+        query_profile(void) :
+            elements(0),
+            nanoseconds(0)
+        {
+            std::fill(counted, counted + hardware_counters::events, false);
+        }
+
+        std::vector<stage_profile> stages;  // the last operator first, each stage followed by its inputs
+        std::uint64_t elements;
+        std::uint64_t nanoseconds;
+        bool counted[hardware_counters::events];    // which hardware counters were sampled
+        std::string counter_status;                 // why requested hardware counters are missing
+    };
+
+    inline std::ostream& operator<<(std::ostream& out, const query_profile& profile)
+    {
+        char line[160];
+
+        std::snprintf(line, sizeof(line), "%-32s %12s %12s %12s %12s %12s\n", "stage", "in", "out", "calls", "total us", "self us");
+        out << line;
+
+        for (auto& stage : profile.stages) {
+            std::string name = std::string(2 * stage.depth, ' ') + stage.name;
+            std::snprintf(line, sizeof(line), "%-32s %12llu %12llu %12llu %12.1f %12.1f\n",
+                name.c_str(),
+                static_cast<unsigned long long>(stage.elements_in),
+                static_cast<unsigned long long>(stage.elements_out),
+                static_cast<unsigned long long>(stage.invocations),
+                stage.nanoseconds / 1000.0,
+                stage.self_nanoseconds / 1000.0);
+            out << line;
+        }
+
+        std::snprintf(line, sizeof(line), "%llu elements in %.1f us\n", static_cast<unsigned long long>(profile.elements), profile.nanoseconds / 1000.0);
+        out << line;
+
+        if (!profile.counter_status.empty()) {
+            out << "hardware counters unavailable: " << profile.counter_status << std::endl;
+        }
+
+        if (std::find(profile.counted, profile.counted + hardware_counters::events, true) == profile.counted + hardware_counters::events) {
+            return out;
+        }
+
+        std::snprintf(line, sizeof(line), "%-32s", "stage (self)");
+        out << line;
+
+        for (int i = 0; i < hardware_counters::events; ++i) {
+            std::snprintf(line, sizeof(line), " %14s", hardware_counters::name(i));
+            out << line;
+        }
+
+        out << "            IPC" << std::endl;
+
+        for (auto& stage : profile.stages) {
+            std::string name = std::string(2 * stage.depth, ' ') + stage.name;
+            std::snprintf(line, sizeof(line), "%-32s", name.c_str());
+            out << line;
+
+            for (int i = 0; i < hardware_counters::events; ++i) {
+                if (profile.counted[i]) {
+                    std::snprintf(line, sizeof(line), " %14llu", static_cast<unsigned long long>(stage.self_events[i]));
+                } else {
+                    std::snprintf(line, sizeof(line), " %14s", "-");
+                }
+                out << line;
+            }
+
+            if (profile.counted[hardware_counters::cycles] && profile.counted[hardware_counters::instructions] && stage.self_events[hardware_counters::cycles]) {
+                std::snprintf(line, sizeof(line), " %14.2f\n", static_cast<double>(stage.self_events[hardware_counters::instructions]) / stage.self_events[hardware_counters::cycles]);
+            } else {
+                std::snprintf(line, sizeof(line), " %14s\n", "-");
+            }
+            out << line;
+        }
+
+        return out;
+    }
+
+    /* the counters a running profile() keeps for each node of its plan */
+    class profile_session {
+    public:
+        struct counters {
+            counters(void) :
+                elements(0),
+                invocations(0),
+                nanoseconds(0)
+            {
+                std::fill(events, events + hardware_counters::events, std::uint64_t(0));
+            }
+
+            std::uint64_t elements;
+            std::uint64_t invocations;
+            std::uint64_t nanoseconds;
+            hardware_counters::values events;
+        };
+
+        /* profiles plan on this thread until the session ends, sampling hardware counters if given */
+        explicit profile_session(const std::shared_ptr<const plan_node>& plan, const hardware_counters* hardware = nullptr) :
+            m_hardware(hardware && hardware->available() ? hardware : nullptr),
+            m_previous(current())
+        {
+            add(plan.get());
+            current() = this;
+        }
+
+        ~profile_session()
+        {
+            current() = m_previous;
+        }
+
+        /* the session running on this thread, if any */
+        static profile_session*& current(void)
+        {
+            static thread_local profile_session* session = nullptr;
+            return session;
+        }
+
+        const hardware_counters* hardware(void) const
+        {
+            return m_hardware;
+        }
+
+        /* the counters of node, if it belongs to the profiled plan */
+        counters* find(const plan_node* node)
+        {
+            auto it = m_counters.find(node);
+            return it == m_counters.end() ? nullptr : &it->second;
+        }
+
+    private:
+        void add(const plan_node* node)
+        {
+            if (node && m_counters.insert(std::make_pair(node, counters())).second) {
+                for (auto& input : node->inputs()) {
+                    add(input.get());
+                }
+            }
+        }
+
+    private:
+        profile_session(const profile_session&);
+        profile_session& operator=(const profile_session&);
+
+    private:
+        std::unordered_map<const plan_node*, counters> m_counters;
+        const hardware_counters* m_hardware;
+        profile_session* m_previous;
+    };
+
+    /* the counters node feeds while this thread profiles a plan it belongs to */
+    inline profile_session::counters* profiled(const plan_node* node, const hardware_counters** hardware = nullptr)
+    {
+        if (!node) {
+            return nullptr;
+        }
+
+        auto session = profile_session::current();
+
+        if (session && hardware) {
+            *hardware = session->hardware();
+        }
+
+        return session ? session->find(node) : nullptr;
+    }
+
+    inline void explain_plan(const std::shared_ptr<const plan_node>& node, int depth, std::string& out)
+    {
+        out += std::string(2 * depth, ' ') + node->name() + "\n";
+
+        for (auto& input : node->inputs()) {
+            explain_plan(input, depth + 1, out);
+        }
+    }
+
+    /* append the rows of node and its inputs, returns the row of node */
+    inline stage_profile profile_plan(const std::shared_ptr<const plan_node>& node, int depth, profile_session& session, query_profile& profile)
+    {
+        stage_profile stage;
+        stage_profile inputs;
+        std::size_t row = profile.stages.size();
+
+        profile.stages.push_back(stage);
+
+        for (auto& input : node->inputs()) {
+            auto input_stage = profile_plan(input, depth + 1, session, profile);
+            stage.elements_in += input_stage.elements_out;
+            inputs.nanoseconds += input_stage.nanoseconds;
+
+            for (int i = 0; i < hardware_counters::events; ++i) {
+                inputs.events[i] += input_stage.events[i];
+            }
+        }
+
+        if (auto counters = session.find(node.get())) {
+            stage.elements_out = counters->elements;
+            stage.invocations = counters->invocations;
+            stage.nanoseconds = counters->nanoseconds;
+            std::copy(counters->events, counters->events + hardware_counters::events, stage.events);
+        }
+
+        stage.name = node->name();
+        stage.depth = depth;
+        stage.self_nanoseconds = stage.nanoseconds > inputs.nanoseconds ? stage.nanoseconds - inputs.nanoseconds : 0;
+
+        for (int i = 0; i < hardware_counters::events; ++i) {
+            stage.self_events[i] = stage.events[i] > inputs.events[i] ? stage.events[i] - inputs.events[i] : 0;
+        }
+
+        profile.stages[row] = stage;
+        return stage;
+    }
+
+    /* charges the wall time of one iterator operation, and the element it hands out, to a profiled stage */
+    class stage_timer {
+    public:
+        explicit stage_timer(const plan_node* node) :
+            m_hardware(nullptr),
+            m_counters(profiled(node, &m_hardware))
+        {
+            if (m_counters) {
+                if (m_hardware) {
+                    m_hardware->read(m_events);
+                }
+
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~stage_timer()
+        {
+            if (m_counters) {
+                auto elapsed = std::chrono::steady_clock::now() - m_start;
+                m_counters->nanoseconds += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+                hardware_counters::values events;
+
+                if (m_hardware && m_hardware->read(events)) {
+                    for (int i = 0; i < hardware_counters::events; ++i) {
+                        m_counters->events[i] += events[i] - m_events[i];
+                    }
+                }
+            }
+        }
+
+        void produced(void)
+        {
+            if (m_counters) {
+                m_counters->elements++;
+            }
+        }
+
+    private:
+        stage_timer(const stage_timer&);
+        stage_timer& operator=(const stage_timer&);
+
+    private:
+        const hardware_counters* m_hardware;
+        profile_session::counters* m_counters;
+        std::chrono::steady_clock::time_point m_start;
+        hardware_counters::values m_events;
+    };
+
+    /* a predicate or selector counting its calls into the stage it belongs to while that stage is profiled */
+    template <typename Functor, typename Signature = decltype(&Functor::operator())>
+    class counted_functor;
+
+    template <typename Functor, typename Result, typename Class, typename... Args>
+    class counted_functor<Functor, Result(Class::*)(Args...) const> {
+    public:
+        counted_functor(const Functor& functor, const plan_node* node) :
+            m_functor(functor),
+            m_node(node)
+        {
+        }
+
+        Result operator()(Args... args) const
+        {
+            if (auto counters = profiled(m_node)) {
+                counters->invocations++;
+            }
+
+            return m_functor(std::forward<Args>(args)...);
+        }
+
+    private:
+        Functor m_functor;
+        const plan_node* m_node;
+    };
+
+    template <typename Functor>
+    auto counted(const Functor& functor, const std::shared_ptr<const plan_node>& node, int) ->
+        counted_functor<Functor, decltype(&Functor::operator())>
+    {
+        return counted_functor<Functor, decltype(&Functor::operator())>(functor, node.get());
+    }
+
+    /* function pointers and generic lambdas go uncounted */
+    template <typename Functor>
+    Functor counted(const Functor& functor, const std::shared_ptr<const plan_node>&, long)
+    {
+        return functor;
+    }
+
+    template <typename Functor>
+    auto counted(const Functor& functor, const std::shared_ptr<const plan_node>& node) ->
+        decltype(counted(functor, node, 0))
+    {
+        return counted(functor, node, 0);
+    }
+
+    /* sets the plan of the queries the operators and from() build */
+    struct plan_access {
+        template <typename Type>
+        static std::shared_ptr<const plan_node> plan(const enumerable<Type>& query)
+        {
+            return query.m_plan;
+        }
+
+        template <typename Type>
+        static enumerable<Type> attach(enumerable<Type> query, const std::shared_ptr<const plan_node>& plan)
+        {
+            query.m_plan = plan;
+            query.m_begin.m_node = plan.get();
+            return query;
+        }
+    };
+
+    inline std::shared_ptr<const plan_node> make_plan(const std::string& name, const std::vector<std::shared_ptr<const plan_node>>& inputs = std::vector<std::shared_ptr<const plan_node>>())
+    {
+        return make_counted<plan_node>(name, inputs);
+    }
+
+    /* iterator */
+    /* the operator stage an iterator's allocations are charged to: its stage(), or "from" for container iterators */
+    template <typename Iterator>
+    class stage_of {
+    private:
+        template <typename Other>
+        static const char* name(int, decltype(Other::stage())* = nullptr)
+        {
+            return Other::stage();
+        }
+
+        template <typename Other>
+        static const char* name(...)
+        {
+            return "from";
+        }
+
+    public:
+        static const char* name(void)
+        {
+            return name<Iterator>(0);
+        }
+    };
+
+    /*
+     * iterators that find their first position lazily do it in a public ensure(); holders run
+     * it once, before anything reads the iterator, since every copy of a query shares them
+     */
+    template <typename Iterator>
+    class lazy_start {
+    private:
+        template <typename Other>
+        static std::true_type test(int, decltype(std::declval<const Other&>().ensure())* = nullptr);
+
+        template <typename Other>
+        static std::false_type test(...);
+
+        static void run(const Iterator& iterator, std::true_type)
+        {
+            iterator.ensure();
+        }
+
+        static void run(const Iterator&, std::false_type)
+        {
+        }
+
+    public:
+        static const bool value = decltype(test<Iterator>(0))::value;
+
+        static void run(const Iterator& iterator)
+        {
+            run(iterator, std::integral_constant<bool, value>());
+        }
+    };
+
+    template <typename Type>
+    struct iterator_wrap {
+        class placeholder {
+        public:
+            virtual std::shared_ptr<placeholder> next(void) = 0;
+            virtual Type value(void) const = 0;
+            virtual bool equals(const std::shared_ptr<placeholder>& rhs) const = 0;
+        };
+
+        template <typename Iterator>
+        class holder : public placeholder {
+        private:
+            enum { unready, starting, ready };
+
+        public:
+            holder(const Iterator& iterator, bool started = !lazy_start<Iterator>::value) :
+                m_iterator(iterator),
+                m_state(started ? ready : unready)
+            {
+            }
+
+            virtual std::shared_ptr<placeholder> next(void)
+            {
+                stage_scope scope(stage_of<Iterator>::name());
+                start();
+                auto it = m_iterator;
+                it++;
+                return make_counted<holder<Iterator>>(it, true);
+            }
+
+            virtual Type value(void) const
+            {
+                start();
+                return *m_iterator;
+            }
+
+            virtual bool equals(const std::shared_ptr<placeholder>& rhs) const
+            {
+                auto real_rhs = std::dynamic_pointer_cast<holder<Iterator>>(rhs);
+                start();
+                real_rhs->start();
+                return m_iterator == real_rhs->m_iterator;
+            }
+
+        private:
+            /* the first thread to read finds the first position, the others wait for it */
+            void start(void) const
+            {
+                int state;
+
+                while ((state = m_state.load(std::memory_order_acquire)) != ready) {
+                    int expected = unready;
+
+                    if (state == unready && m_state.compare_exchange_weak(expected, starting, std::memory_order_acquire)) {
+                        try {
+                            lazy_start<Iterator>::run(m_iterator);
+                        } catch (...) {
+                            m_state.store(unready, std::memory_order_release);
+                            throw;
+                        }
+
+                        m_state.store(ready, std::memory_order_release);
+                        return;
+                    }
+
+                    std::this_thread::yield();
+                }
+            }
+
+        private:
+            Iterator m_iterator;
+            mutable std::atomic<int> m_state;
+        };
+    };
+
+    template <typename Type, typename Iterator>
+    std::shared_ptr<typename iterator_wrap<Type>::placeholder> make_placeholder(const Iterator& iterator)
+    {
+        stage_scope scope(stage_of<Iterator>::name());
+        return make_counted<typename iterator_wrap<Type>::template holder<Iterator>>(iterator);
+    }
+
+    template <typename Type, typename Iterator>
+    enumerable<Type> reverse_view(const Iterator& begin, const Iterator& end, const std::shared_ptr<void>& owner);
+
+    template <typename Type, typename Iterator>
+    enumerable<Type> reverse_view(const std::reverse_iterator<Iterator>& begin, const std::reverse_iterator<Iterator>& end, const std::shared_ptr<void>& owner);
+
+    template <typename Type, typename Iterator>
+    enumerable<Type> from_view(const Iterator& begin, const Iterator& end, const std::shared_ptr<void>& owner);
+
+    /*
+     * the bidirectional range an enumerable reads straight from, if any: lets reverse() walk it
+     * backwards in place and, for random access ranges, lets workers split it by index
+     */
+    template <typename Type>
+    struct source_wrap {
+        class placeholder {
+        public:
+            virtual bool random_access(void) const = 0;
+            virtual std::size_t size(void) const = 0;
+            virtual Type at(std::size_t index) const = 0;
+            virtual enumerable<Type> reverse(void) const = 0;
+            virtual enumerable<Type> slice(std::size_t first, std::size_t last) const = 0;
+        };
+
+        template <typename Iterator>
+        class holder : public placeholder {
+        public:
+            holder(const Iterator& begin, const Iterator& end, const std::shared_ptr<void>& owner) :
+                m_begin(begin),
+                m_end(end),
+                m_size(distance(begin, end, typename std::iterator_traits<Iterator>::iterator_category())),
+                m_owner(owner)
+            {
+            }
+
+            virtual bool random_access(void) const
+            {
+                return std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>::value;
+            }
+
+            virtual std::size_t size(void) const
+            {
+                return m_size;
+            }
+
+            virtual Type at(std::size_t index) const
+            {
+                return at(index, typename std::iterator_traits<Iterator>::iterator_category());
+            }
+
+            virtual enumerable<Type> reverse(void) const
+            {
+                return reverse_view<Type>(m_begin, m_end, m_owner);
+            }
+
+            /* elements [first, last) as a query of their own, random access sources only */
+            virtual enumerable<Type> slice(std::size_t first, std::size_t last) const
+            {
+                return slice(first, last, typename std::iterator_traits<Iterator>::iterator_category());
+            }
+
+        private:
+            static std::size_t distance(const Iterator& begin, const Iterator& end, std::random_access_iterator_tag)
+            {
+                return static_cast<std::size_t>(end - begin);
+            }
+
+            static std::size_t distance(const Iterator&, const Iterator&, std::bidirectional_iterator_tag)
+            {
+                return 0;
+            }
+
+            Type at(std::size_t index, std::random_access_iterator_tag) const
+            {
+                return *(m_begin + index);
+            }
+
+            Type at(std::size_t, std::bidirectional_iterator_tag) const
+            {
+                throw enumerable_exception("the source is not random access");
+            }
+
+            enumerable<Type> slice(std::size_t first, std::size_t last, std::random_access_iterator_tag) const
+            {
+                typedef typename std::iterator_traits<Iterator>::difference_type Difference;
+                return from_view<Type>(m_begin + static_cast<Difference>(first), m_begin + static_cast<Difference>(last), m_owner);
+            }
+
+            enumerable<Type> slice(std::size_t, std::size_t, std::bidirectional_iterator_tag) const
+            {
+                throw enumerable_exception("the source is not random access");
+            }
+
+        private:
+            Iterator m_begin;
+            Iterator m_end;
+            std::size_t m_size;
+            std::shared_ptr<void> m_owner;
+        };
+    };
+
+    template <typename Type, typename Iterator>
+    std::shared_ptr<typename source_wrap<Type>::placeholder>
+        make_source(const Iterator& begin, const Iterator& end, const std::shared_ptr<void>& owner, std::bidirectional_iterator_tag)
+    {
+        return make_counted<typename source_wrap<Type>::template holder<Iterator>>(begin, end, owner);
+    }
+
+    template <typename Type, typename Iterator>
+    std::shared_ptr<typename source_wrap<Type>::placeholder>
+        make_source(const Iterator&, const Iterator&, const std::shared_ptr<void>&, std::input_iterator_tag)
+    {
+        return nullptr;
+    }
+
+    template <typename Type, typename Iterator>
+    std::shared_ptr<typename source_wrap<Type>::placeholder>
+        make_source(const Iterator& begin, const Iterator& end, const std::shared_ptr<void>& owner = nullptr)
+    {
+        return make_source<Type>(begin, end, owner, typename std::iterator_traits<Iterator>::iterator_category());
+    }
+
+    template <typename Type>
+    class enumerable_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef enumerable_iterator<Type> Self;
+        friend class enumerable<Type>;
+        friend struct plan_access;
+
+    private:
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        const plan_node* m_node;    // the stage whose output this is, for profile()
+
+    public:
+        static const char* stage(void)
+        {
+            return nullptr;
+        }
+
+        template <typename Iterator>
+        enumerable_iterator(const Iterator& iterator) :
+            m_iterator(make_placeholder<Type>(iterator)),
+            m_node(nullptr)
+        {
+        }
+
+        Self& operator++()
+        {
+            stage_timer timer(m_node);
+            m_iterator = m_iterator->next();
+            timer.produced();
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            stage_timer timer(m_node);
+            return m_iterator->value();
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            stage_timer timer(m_node);
+            return m_iterator->equals(rhs.m_iterator);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+    };
+
+    template <typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    enumerable_iterator<Type> make_enumerable_iterator(const Iterator& iterator)
+    {
+        return enumerable_iterator<Type>(iterator);
+    }
+
+    /* walks the outer range and, for each element, the collection selected from it */
+    template <typename Type, typename OuterType, typename Collection, typename CollectionFunctor, typename ResultFunctor>
+    class flatten_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef flatten_iterator<Type, OuterType, Collection, CollectionFunctor, ResultFunctor> Self;
+        typedef typename recover_type<decltype(*std::begin(std::declval<Collection&>()))>::type InnerType;
+
+    private:
+        mutable std::shared_ptr<typename iterator_wrap<OuterType>::placeholder> m_outer;
+        std::shared_ptr<typename iterator_wrap<OuterType>::placeholder> m_outer_end;
+        mutable std::shared_ptr<OuterType> m_current;
+        mutable std::shared_ptr<Collection> m_collection;
+        mutable std::shared_ptr<typename iterator_wrap<InnerType>::placeholder> m_inner;
+        mutable std::shared_ptr<typename iterator_wrap<InnerType>::placeholder> m_inner_end;
+        CollectionFunctor m_collection_selector;
+        ResultFunctor m_result_selector;
+        mutable bool m_ready;
+
+    public:
+        static const char* stage(void)
+        {
+            return "select_many";
+        }
+
+        template <typename Iterator>
+        flatten_iterator(const Iterator& begin, const Iterator& end, const CollectionFunctor& collection_selector, const ResultFunctor& result_selector) :
+            m_outer(make_placeholder<OuterType>(begin)),
+            m_outer_end(make_placeholder<OuterType>(end)),
+            m_collection_selector(collection_selector),
+            m_result_selector(result_selector),
+            m_ready(false)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+            m_inner = m_inner->next();
+            settle();
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return m_result_selector(*m_current, m_inner->value());
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            ensure();
+            rhs.ensure();
+
+            if (!m_outer->equals(rhs.m_outer)) {
+                return false;
+            }
+
+            return !m_inner || !rhs.m_inner || m_inner->equals(rhs.m_inner);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the first collection is opened on first use, not when the query is built */
+        void ensure(void) const
+        {
+            if (m_ready) {
+                return;
+            }
+
+            if (!m_outer->equals(m_outer_end)) {
+                open();
+                settle();
+            }
+
+            m_ready = true;
+        }
+
+    private:
+        void open(void) const
+        {
+            m_current = make_counted<OuterType>(m_outer->value());
+            m_collection = make_counted<Collection>(m_collection_selector(*m_current));
+            m_inner = make_placeholder<InnerType>(std::begin(*m_collection));
+            m_inner_end = make_placeholder<InnerType>(std::end(*m_collection));
+        }
+
+        /* move on to the next non empty collection, dropping the last one at the end */
+        void settle(void) const
+        {
+            while (m_inner->equals(m_inner_end)) {
+                m_outer = m_outer->next();
+
+                if (m_outer->equals(m_outer_end)) {
+                    m_current.reset();
+                    m_collection.reset();
+                    m_inner.reset();
+                    m_inner_end.reset();
+                    return;
+                }
+
+                open();
+            }
+        }
+    };
+
+    template <typename Iterator,
+              typename CollectionFunctor,
+              typename ResultFunctor,
+              typename OuterType = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type,
+              typename Collection = typename recover_type<typename functor_retriver<decltype(&CollectionFunctor::operator())>::type>::type,
+              typename Type = typename functor_retriver<decltype(&ResultFunctor::operator())>::type>
+    flatten_iterator<Type, OuterType, Collection, CollectionFunctor, ResultFunctor>
+        make_flatten_iterator(const Iterator& begin, const Iterator& end, const CollectionFunctor& collection_selector, const ResultFunctor& result_selector)
+    {
+        return flatten_iterator<Type, OuterType, Collection, CollectionFunctor, ResultFunctor>(begin, end, collection_selector, result_selector);
+    }
+
+    template <typename Container, typename Type>
+    class storage_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef storage_iterator<Container, Type> Self;
+
+    private:
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        std::shared_ptr<Container> m_owner;
+
+    public:
+        static const char* stage(void)
+        {
+            return "from";
+        }
+
+        template <typename Iterator>
+        storage_iterator(const std::shared_ptr<Container>& owner, const Iterator& iterator) :
+            m_owner(owner),
+            m_iterator(make_placeholder<Type>(iterator))
+        {
+        }
+
+        Self& operator++()
+        {
+            m_iterator = m_iterator->next();
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            m_iterator = m_iterator->next();
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            return m_iterator->value();
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return m_iterator->equals(rhs.m_iterator);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !m_iterator->equals(rhs.m_iterator);
+        }
+    };
+
+    template <typename Container, typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    storage_iterator<Container, Type> make_storage_iterator(const std::shared_ptr<Container>& values, const Iterator& iterator)
+    {
+        return storage_iterator<Container, Type>(values, iterator);
+    }
+
+    template <typename Type, typename Functor>
+    class select_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef select_iterator<Type, Functor> Self;
+
+    private:
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        Functor m_selector;
+
+    public:
+        static const char* stage(void)
+        {
+            return "select";
+        }
+
+        template <typename Iterator>
+        select_iterator(const Iterator& iterator, const Functor& selector) :
+            m_selector(selector),
+            m_iterator(make_placeholder<Type>(iterator))
+        {
+        }
+
+        Self& operator++()
+        {
+            m_iterator = m_iterator->next();
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            m_iterator = m_iterator->next();
+            return temp;
+        }
+
+        typename functor_retriver<decltype(&Functor::operator())>::type operator*() const
+        {
+            return m_selector(m_iterator->value());
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return m_iterator->equals(rhs.m_iterator);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !m_iterator->equals(rhs.m_iterator);
+        }
+    };
+
+    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    select_iterator<Type, Functor> make_select_iterator(const Iterator& iterator, const Functor& selector)
+    {
+        return select_iterator<Type, Functor>(iterator, selector);
+    }
+
+    /* select_iterator for let(): the pair of the current element is built once however often it is read */
+    template <typename Type, typename Value, typename Functor>
+    class let_iterator : public std::iterator<std::forward_iterator_tag, let_value<Type, Value>> {
+    private:
+        typedef let_iterator<Type, Value, Functor> Self;
+
+    private:
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        Functor m_selector;
+        mutable std::shared_ptr<const let_value<Type, Value>> m_current;    // read and set atomically, the first position is shared
+
+    public:
+        static const char* stage(void)
+        {
+            return "let";
+        }
+
+        template <typename Iterator>
+        let_iterator(const Iterator& iterator, const Functor& selector) :
+            m_iterator(make_placeholder<Type>(iterator)),
+            m_selector(selector)
+        {
+        }
+
+        Self& operator++()
+        {
+            m_iterator = m_iterator->next();
+            m_current = nullptr;
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        let_value<Type, Value> operator*() const
+        {
+            auto current = std::atomic_load(&m_current);
+
+            if (!current) {
+                auto element = make_counted<const Type>(m_iterator->value());
+                current = make_counted<const let_value<Type, Value>>(element, m_selector(*element));
+                std::atomic_store(&m_current, current);
+            }
+
+            return *current;
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return m_iterator->equals(rhs.m_iterator);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !m_iterator->equals(rhs.m_iterator);
+        }
+    };
+
+    template <typename Value, typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    let_iterator<Type, Value, Functor> make_let_iterator(const Iterator& iterator, const Functor& selector)
+    {
+        return let_iterator<Type, Value, Functor>(iterator, selector);
+    }
+
+    template <typename Type>
+    class skip_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef skip_iterator<Type> Self;
+
+    private:
+        mutable std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
+        int m_count;
+        mutable bool m_ready;
+
+    public:
+        static const char* stage(void)
+        {
+            return "skip";
+        }
+
+        template <typename Iterator>
+        skip_iterator(const Iterator& begin, const Iterator& end, int count) :
+            m_iterator(make_placeholder<Type>(begin)),
+            m_end(make_placeholder<Type>(end)),
+            m_count(count),
+            m_ready(false)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+            m_iterator = m_iterator->next();
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return m_iterator->value();
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            ensure();
+            rhs.ensure();
+            return m_iterator->equals(rhs.m_iterator);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the skipped prefix is walked on first use, not when the query is built */
+        void ensure(void) const
+        {
+            if (m_ready) {
+                return;
+            }
+
+            for (int i = 0; i < m_count && !m_iterator->equals(m_end); i++) {
+                m_iterator = m_iterator->next();
+            }
+
+            m_ready = true;
+        }
+    };
+
+    template <typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    skip_iterator<Type> make_skip_iterator(const Iterator& begin, const Iterator& end, int count)
+    {
+        return skip_iterator<Type>(begin, end, count);
+    }
+
+    template <typename Type, typename Functor>
+    class skip_while_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef skip_while_iterator<Type, Functor> Self;
+
+    private:
+        mutable std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_iterator;
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
+        Functor m_predicate;
+        mutable bool m_ready;
+
+    public:
+        static const char* stage(void)
+        {
+            return "skip_while";
+        }
+
+        template <typename Iterator>
+        skip_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate) :
+            m_iterator(make_placeholder<Type>(begin)),
+            m_end(make_placeholder<Type>(end)),
+            m_predicate(predicate),
+            m_ready(false)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+            m_iterator = m_iterator->next();
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return m_iterator->value();
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            ensure();
+            rhs.ensure();
+            return m_iterator->equals(rhs.m_iterator);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the leading run of matches is walked on first use, not when the query is built */
+        void ensure(void) const
+        {
+            if (m_ready) {
+                return;
+            }
+
+            while (!m_iterator->equals(m_end) && m_predicate(m_iterator->value())) {
+                m_iterator = m_iterator->next();
+            }
+
+            m_ready = true;
+        }
+    };
+
+    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    skip_while_iterator<Type, Functor> make_skip_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate)
+    {
+        return skip_while_iterator<Type, Functor>(begin, end, predicate);
+    }
+
+    template <typename Type>
+    class take_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef take_iterator<Type> Self;
+
+    private:
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_begin;
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
+        int m_count;
+        int m_current;
+
+    public:
+        static const char* stage(void)
+        {
+            return "take";
+        }
+
+        template <typename Iterator>
+        take_iterator(const Iterator& begin, const Iterator& end, int count) :
+            m_begin(make_placeholder<Type>(begin)),
+            m_end(make_placeholder<Type>(end)),
+            m_count(count),
+            m_current(0)
+        {
+            if (m_current == m_count) {
+                m_begin = m_end;
+            }
+        }
+
+        Self& operator++()
+        {
+            if (++m_current == m_count) {
+                m_begin = m_end;
+
+            } else {
+                m_begin = m_begin->next();
+            }
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+
+            if (++m_current == m_count) {
+                m_begin = m_end;
+
+            } else {
+                m_begin = m_begin->next();
+            }
+
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            return m_begin->value();
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return m_begin->equals(rhs.m_begin);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !m_begin->equals(rhs.m_begin);
+        }
+    };
+
+    template <typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    take_iterator<Type> make_take_iterator(const Iterator& begin, const Iterator& end, int count)
+    {
+        return take_iterator<Type>(begin, end, count);
+    }
+
+    template <typename Type, typename Functor>
+    class take_while_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef take_while_iterator<Type, Functor> Self;
+
+    private:
+        mutable std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_begin;
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
+        Functor m_predicate;
+        mutable bool m_ready;
+
+    public:
+        static const char* stage(void)
+        {
+            return "take_while";
+        }
+
+        template <typename Iterator>
+        take_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate) :
+            m_begin(make_placeholder<Type>(begin)),
+            m_end(make_placeholder<Type>(end)),
+            m_predicate(predicate),
+            m_ready(false)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+            m_begin = m_begin->next();
+            m_ready = false;
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return m_begin->value();
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            ensure();
+            rhs.ensure();
+            return m_begin->equals(rhs.m_begin);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the predicate of the current element is checked when it is first looked at */
+        void ensure(void) const
+        {
+            if (m_ready) {
+                return;
+            }
+
+            if (!m_begin->equals(m_end) && !m_predicate(m_begin->value())) {
+                m_begin = m_end;
+            }
+
+            m_ready = true;
+        }
+    };
+
+    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    take_while_iterator<Type, Functor> make_take_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate)
+    {
+        return take_while_iterator<Type, Functor>(begin, end, predicate);
+    }
+
+    template <typename Type, typename Functor>
+    class where_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef where_iterator<Type, Functor> Self;
+
+    private:
+        mutable std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_begin;
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
+        Functor m_predicate;
+        mutable bool m_ready;
+
+    public:
+        static const char* stage(void)
+        {
+            return "where";
+        }
+
+        template <typename Iterator>
+        where_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate) :
+            m_begin(make_placeholder<Type>(begin)),
+            m_end(make_placeholder<Type>(end)),
+            m_predicate(predicate),
+            m_ready(false)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+            where(true);
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return m_begin->value();
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            ensure();
+            rhs.ensure();
+            return m_begin->equals(rhs.m_begin);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the scan for the first match runs on first use, not when the query is built */
+        void ensure(void) const
+        {
+            if (!m_ready) {
+                where(false);
+                m_ready = true;
+            }
+        }
+
+    private:
+        void where(bool next) const
+        {
+            if (m_begin->equals(m_end)) {
+                return;
+            }
+
+            if (next) {
+                m_begin = m_begin->next();
+            }
+
+            while (!m_begin->equals(m_end) && !m_predicate(m_begin->value())) {
+                m_begin = m_begin->next();
+            }
+        }
+    };
+
+    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    where_iterator<Type, Functor> make_where_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate)
+    {
+        return where_iterator<Type, Functor>(begin, end, predicate);
+    }
+
+    template <typename LeftType, typename RightType>
+    class zip_iterator : public std::iterator<std::forward_iterator_tag, std::pair<LeftType, RightType>> {
+    private:
+        typedef zip_iterator<LeftType, RightType> Self;
+
+    private:
+        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_begin;
+        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_end;
+        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_begin;
+        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_end;
+
+    public:
+        static const char* stage(void)
+        {
+            return "zip";
+        }
+
+        template <typename LeftIterator, typename RightIterator>
+        zip_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end) :
+            m_left_begin(make_placeholder<LeftType>(left_begin)),
+            m_left_end(make_placeholder<LeftType>(left_end)),
+            m_right_begin(make_placeholder<RightType>(right_begin)),
+            m_right_end(make_placeholder<RightType>(right_end))
+        {
+        }
+
+        Self& operator++()
+        {
+            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
+                m_left_begin = m_left_begin->next();
+                m_right_begin = m_right_begin->next();
+            }
+
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+
+            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
+                m_left_begin = m_left_begin->next();
+                m_right_begin = m_right_begin->next();
+            }
+
+            return temp;
+        }
+
+        std::pair<LeftType, RightType> operator*() const
+        {
+            return std::make_pair(m_left_begin->value(), m_right_begin->value());
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return m_left_begin->equals(rhs.m_left_begin) || m_right_begin->equals(rhs.m_right_begin);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !m_left_begin->equals(rhs.m_left_begin) && !m_right_begin->equals(rhs.m_right_begin);
+        }
+    };
+
+    template <typename LeftIterator,
+              typename RightIterator,
+              typename LeftType = typename recover_type<typename std::iterator_traits<LeftIterator>::value_type>::type,
+              typename RightType = typename recover_type<typename std::iterator_traits<RightIterator>::value_type>::type>
+    zip_iterator<LeftType, RightType> make_zip_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end)
+    {
+        return zip_iterator<LeftType, RightType>(
+            left_begin,
+            left_end,
+            right_begin,
+            right_end
+            );
+    }
+
+    template <typename KeyType, typename LeftType, typename RightType, typename Functor>
+    class zip_with_iterator : public std::iterator<std::forward_iterator_tag, std::pair<LeftType, RightType>> {
+    private:
+        typedef zip_with_iterator<KeyType, LeftType, RightType, Functor> Self;
+
+    private:
+        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_begin;
+        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_end;
+        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_begin;
+        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_end;
+        Functor m_selector;
+
+    public:
+        static const char* stage(void)
+        {
+            return "zip";
+        }
+
+        template <typename LeftIterator, typename RightIterator>
+        zip_with_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end, const Functor& selector) :
+            m_left_begin(make_placeholder<LeftType>(left_begin)),
+            m_left_end(make_placeholder<LeftType>(left_end)),
+            m_right_begin(make_placeholder<RightType>(right_begin)),
+            m_right_end(make_placeholder<RightType>(right_end)),
+            m_selector(selector)
+        {
+        }
+
+        Self& operator++()
+        {
+            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
+                m_left_begin = m_left_begin->next();
+                m_right_begin = m_right_begin->next();
+            }
+
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+
+            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
+                m_left_begin = m_left_begin->next();
+                m_right_begin = m_right_begin->next();
+            }
+
+            return temp;
+        }
+
+        std::pair<KeyType, RightType> operator*() const
+        {
+            return std::make_pair(m_selector(m_left_begin->value(), m_right_begin->value()), m_right_begin->value());
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return m_left_begin->equals(rhs.m_left_begin) || m_right_begin->equals(rhs.m_right_begin);
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !m_left_begin->equals(rhs.m_left_begin) && !m_right_begin->equals(rhs.m_right_begin);
+        }
+    };
+
+    template <typename LeftIterator,
+              typename RightIterator,
+              typename Functor,
+              typename KeyType = typename functor_retriver<decltype(&Functor::operator())>::type,
+              typename LeftType = typename recover_type<typename std::iterator_traits<LeftIterator>::value_type>::type,
+              typename RightType = typename recover_type<typename std::iterator_traits<RightIterator>::value_type>::type>
+    zip_with_iterator<KeyType, LeftType, RightType, Functor> make_zip_with_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end, const Functor& selector)
+    {
+        return zip_with_iterator<KeyType, LeftType, RightType, Functor>(
+            left_begin,
+            left_end,
+            right_begin,
+            right_end,
+            selector
+            );
+    }
+
+    /* binary encoding of partial state written to spill files, specialize for other types */
+    template <typename Type>
+    struct serializer {
+        static void write(std::FILE* file, const Type& value)
+        {
+            static_assert(std::is_trivially_copyable<Type>::value, "specialize sb::serializer for this type");
+
+            if (std::fwrite(&value, sizeof(Type), 1, file) != 1) {
+                throw enumerable_exception("failed to write spill file");
+            }
+        }
+
+        static void read(std::FILE* file, Type& value)
+        {
+            if (std::fread(&value, sizeof(Type), 1, file) != 1) {
+                throw enumerable_exception("failed to read spill file");
+            }
+        }
+    };
+
+    template <typename Char, typename Traits, typename Allocator>
+    struct serializer<std::basic_string<Char, Traits, Allocator>> {
+        static void write(std::FILE* file, const std::basic_string<Char, Traits, Allocator>& value)
+        {
+            serializer<std::size_t>::write(file, value.size());
+
+            if (std::fwrite(value.data(), sizeof(Char), value.size(), file) != value.size()) {
+                throw enumerable_exception("failed to write spill file");
+            }
+        }
+
+        static void read(std::FILE* file, std::basic_string<Char, Traits, Allocator>& value)
+        {
+            std::size_t size = 0;
+            serializer<std::size_t>::read(file, size);
+            value.resize(size);
+
+            if (size > 0 && std::fread(&value[0], sizeof(Char), size, file) != size) {
+                throw enumerable_exception("failed to read spill file");
+            }
+        }
+    };
+
+    template <typename First, typename Second>
+    struct serializer<std::pair<First, Second>> {
+        static void write(std::FILE* file, const std::pair<First, Second>& value)
+        {
+            serializer<First>::write(file, value.first);
+            serializer<Second>::write(file, value.second);
+        }
+
+        static void read(std::FILE* file, std::pair<First, Second>& value)
+        {
+            serializer<First>::read(file, value.first);
+            serializer<Second>::read(file, value.second);
+        }
+    };
+
+    template <typename Type, typename Allocator>
+    struct serializer<std::vector<Type, Allocator>> {
+        static void write(std::FILE* file, const std::vector<Type, Allocator>& values)
+        {
+            serializer<std::size_t>::write(file, values.size());
+
+            for (auto& value : values) {
+                serializer<Type>::write(file, value);
+            }
+        }
+
+        static void read(std::FILE* file, std::vector<Type, Allocator>& values)
+        {
+            std::size_t size = 0;
+            serializer<std::size_t>::read(file, size);
+            values.resize(size);
+
+            for (auto& value : values) {
+                serializer<Type>::read(file, value);
+            }
+        }
+    };
+
+    /*
+     * hash partitioned temp files holding (key, state) runs; a partition is merged back into
+     * memory only when iteration reaches it, and is held by the iterators standing in it. the
+     * files are read under a lock, and iterators reading the same partition share one merge
+     */
+    template <typename KeyType, typename StateType, typename ResultType>
+    class spill_storage {
+    public:
+        typedef std::function<void(StateType&, const StateType&)> Combine;
+        typedef std::function<ResultType(const KeyType&, StateType&)> Finish;
+        typedef std::vector<ResultType> Values;
+
+        spill_storage(std::size_t partitions, const Combine& combine, const Finish& finish) :
+            m_files(partitions, nullptr),
+            m_records(partitions, 0),
+            m_combine(combine),
+            m_finish(finish),
+            m_loaded(partitions)
+        {
+        }
+
+        ~spill_storage()
+        {
+            for (auto file : m_files) {
+                if (file) {
+                    std::fclose(file);
+                }
+            }
+        }
+
+        template <typename Table>
+        void spill(const Table& table)
+        {
+            trace_span span("spill_reduce_by", "spill");
+            hasher<KeyType> hash;
+
+            span.arg("rows", table.size());
+
+            for (auto& pair : table) {
+                auto partition = partition_of(hash(pair.first), m_files.size());
+
+                if (!m_files[partition] && !(m_files[partition] = std::tmpfile())) {
+                    throw enumerable_exception("failed to create spill file");
+                }
+
+                serializer<KeyType>::write(m_files[partition], pair.first);
+                serializer<StateType>::write(m_files[partition], pair.second);
+                m_records[partition]++;
+            }
+        }
+
+        std::size_t partitions(void) const
+        {
+            return m_files.size();
+        }
+
+        /* first partition at or after partition holding any record */
+        std::size_t next(std::size_t partition) const
+        {
+            while (partition < m_files.size() && m_records[partition] == 0) {
+                partition++;
+            }
+
+            return partition;
+        }
+
+        std::shared_ptr<const Values> load(std::size_t partition)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::shared_ptr<const Values> loaded;
+
+            if (m_loaded == partition && (loaded = m_values.lock())) {
+                return loaded;
+            }
+
+            trace_span span("spill_reduce_by", "merge");
+            flat_map<KeyType, StateType> table;
+            auto file = m_files[partition];
+
+            span.arg("partition", partition);
+            span.arg("records", m_records[partition]);
+
+            std::rewind(file);
+
+            for (std::size_t i = 0; i < m_records[partition]; ++i) {
+                KeyType key;
+                StateType state;
+
+                serializer<KeyType>::read(file, key);
+                serializer<StateType>::read(file, state);
+
+                auto hit = table.find_or_insert(key, [&key, &state]() { return std::make_pair(key, state); });
+
+                if (!hit.second) {
+                    m_combine(hit.first->second, state);
+                }
+            }
+
+            std::fseek(file, 0, SEEK_END);
+            auto values = make_counted<Values>();
+
+            for (auto& pair : table) {
+                values->push_back(m_finish(pair.first, pair.second));
+            }
+
+            m_loaded = partition;
+            m_values = values;
+            return values;
+        }
+
+    private:
+        spill_storage(const spill_storage&);
+        spill_storage& operator=(const spill_storage&);
+
+    private:
+        std::vector<std::FILE*> m_files;
+        std::vector<std::size_t> m_records;
+        Combine m_combine;
+        Finish m_finish;
+        std::mutex m_mutex;
+        std::size_t m_loaded;
+        std::weak_ptr<const Values> m_values;
+    };
+
+    template <typename Storage, typename Type>
+    class spill_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef spill_iterator<Storage, Type> Self;
+
+    private:
+        std::shared_ptr<Storage> m_storage;
+        std::size_t m_partition;
+        std::size_t m_index;
+        mutable std::shared_ptr<const typename Storage::Values> m_values;
+
+    public:
+        static const char* stage(void)
+        {
+            return "spill";
+        }
+
+        spill_iterator(const std::shared_ptr<Storage>& storage, std::size_t partition) :
+            m_storage(storage),
+            m_partition(storage->next(partition)),
+            m_index(0)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+
+            if (++m_index >= m_values->size()) {
+                m_partition = m_storage->next(m_partition + 1);
+                m_index = 0;
+                m_values = nullptr;
+                ensure();
+            }
+
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return (*m_values)[m_index];
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return m_partition == rhs.m_partition && m_index == rhs.m_index;
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the partition is merged on first use */
+        void ensure(void) const
+        {
+            if (!m_values && m_partition < m_storage->partitions()) {
+                m_values = m_storage->load(m_partition);
+            }
+        }
+    };
+
+    template <typename Storage, typename Type = typename Storage::Values::value_type>
+    spill_iterator<Storage, typename recover_type<Type>::type> make_spill_iterator(const std::shared_ptr<Storage>& storage, std::size_t partition)
+    {
+        return spill_iterator<Storage, typename recover_type<Type>::type>(storage, partition);
+    }
+
+    template <typename Type>
+    class empty_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef empty_iterator<Type> Self;
+
+    public:
+        static const char* stage(void)
+        {
+            return "empty";
+        }
+
+        empty_iterator()
+        {
+        }
+
+        Self& operator++()
+        {
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            return *this;
+        }
+
+        Type operator*() const
+        {
+            throw enumerable_exception("get a value from an empty collection");
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            return true;
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return false;
+        }
+    };
+
+    template <typename Type>
+    empty_iterator<Type> make_empty_iterator(void)
+    {
+        return empty_iterator<Type>();
+    }
+
+    /* walks a flat list of segments, so chained concats cost the same as a single one */
+    template <typename Type>
+    class concat_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef concat_iterator<Type> Self;
+
+    private:
+        std::shared_ptr<const std::vector<enumerable<Type>>> m_segments;
+        mutable std::size_t m_index;
+        mutable enumerable_iterator<Type> m_current;
+        mutable enumerable_iterator<Type> m_current_end;
+        mutable bool m_ready;
+
+    public:
+        static const char* stage(void)
+        {
+            return "concat";
+        }
+
+        concat_iterator(const std::shared_ptr<const std::vector<enumerable<Type>>>& segments, std::size_t index) :
+            m_segments(segments),
+            m_index(index),
+            m_current(make_empty_iterator<Type>()),
+            m_current_end(make_empty_iterator<Type>()),
+            m_ready(false)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+            ++m_current;
+            settle();
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return *m_current;
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            ensure();
+            rhs.ensure();
+
+            if (m_index != rhs.m_index) {
+                return false;
+            }
+
+            return m_index == m_segments->size() || m_current == rhs.m_current;
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the first non-empty segment is opened on first use */
+        void ensure(void) const
+        {
+            if (m_ready) {
+                return;
+            }
+
+            if (m_index < m_segments->size()) {
+                open();
+                settle();
+            }
+
+            m_ready = true;
+        }
+
+    private:
+        void open(void) const
+        {
+            m_current = (*m_segments)[m_index].begin();
+            m_current_end = (*m_segments)[m_index].end();
+        }
+
+        void settle(void) const
+        {
+            while (m_current == m_current_end) {
+                if (++m_index == m_segments->size()) {
+                    return;
+                }
+
+                open();
+            }
+        }
+    };
+
+    template <typename Type>
+    concat_iterator<Type> make_concat_iterator(const std::shared_ptr<const std::vector<enumerable<Type>>>& segments, std::size_t index)
+    {
+        return concat_iterator<Type>(segments, index);
+    }
+
+    /* builds a range on first use; every copy of the query shares the one result */
+    template <typename Type>
+    class deferred_source {
+    private:
+        std::function<enumerable<Type>()> m_factory;
+        std::once_flag m_flag;
+        std::shared_ptr<enumerable<Type>> m_result;
+
+    public:
+        explicit deferred_source(const std::function<enumerable<Type>()>& factory) :
+            m_factory(factory)
+        {
+        }
+
+        const enumerable<Type>& get(void)
+        {
+            std::call_once(m_flag, [this]() {
+                m_result = make_counted<enumerable<Type>>(m_factory());
+                m_factory = nullptr;
+            });
+
+            return *m_result;
+        }
+
+        /* the result for a caller that holds the only reference, without keeping a copy */
+        enumerable<Type> release(void)
+        {
+            get();
+
+            auto result = std::move(*m_result);
+            *m_result = enumerable<Type>();
+            return result;
+        }
+    };
+
+    template <typename Type>
+    class deferred_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef deferred_iterator<Type> Self;
+
+    private:
+        std::shared_ptr<deferred_source<Type>> m_source;
+        bool m_end;
+        mutable enumerable_iterator<Type> m_iterator;
+        mutable bool m_ready;
+
+    public:
+        static const char* stage(void)
+        {
+            return "defer";
+        }
+
+        deferred_iterator(const std::shared_ptr<deferred_source<Type>>& source, bool end) :
+            m_source(source),
+            m_end(end),
+            m_iterator(make_empty_iterator<Type>()),
+            m_ready(false)
+        {
+        }
+
+        Self& operator++()
+        {
+            ensure();
+            ++m_iterator;
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            ensure();
+            return *m_iterator;
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            ensure();
+            rhs.ensure();
+            return m_iterator == rhs.m_iterator;
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the deferred factory runs on first use, not when the query is built */
+        void ensure(void) const
+        {
+            if (!m_ready) {
+                m_iterator = m_end ? m_source->get().end() : m_source->get().begin();
+                m_ready = true;
+            }
+        }
+    };
+
+    template <typename Type>
+    deferred_iterator<Type> make_deferred_iterator(const std::shared_ptr<deferred_source<Type>>& source, bool end)
+    {
+        return deferred_iterator<Type>(source, end);
+    }
+
+    /*
+     * elements of a range cached as they are first produced, shared by every copy of the
+     * query; once limit elements are cached the cursor stops and later positions are read
+     * by each iterator from its own copy of it. The cache is a deque so an element keeps its
+     * address while the cache grows, and once sealed it is read without the lock
+     */
+    template <typename Type>
+    class buffer_state {
+    private:
+        std::mutex m_mutex;
+        std::deque<Type> m_values;
+        enumerable_iterator<Type> m_cursor;
+        enumerable_iterator<Type> m_end;
+        std::size_t m_limit;
+        bool m_done;
+        std::atomic<bool> m_sealed;     // the source is exhausted or the limit reached, so m_values no longer changes
+
+    public:
+        buffer_state(const enumerable_iterator<Type>& begin, const enumerable_iterator<Type>& end, std::size_t limit) :
+            m_cursor(begin),
+            m_end(end),
+            m_limit(limit),
+            m_done(false),
+            m_sealed(false)
+        {
+        }
+
+        /*
+         * the cached element at index, or null with overflow set to the position just past the
+         * cache once index has gone beyond the limit, or null alone at the end of the source
+         */
+        const Type* lookup(std::size_t index, maybe<enumerable_iterator<Type>>& overflow)
+        {
+            if (m_sealed.load(std::memory_order_acquire) && index < m_values.size()) {
+                return &m_values[index];
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (fill(index)) {
+                return &m_values[index];
+            }
+
+            if (!m_done) {
+                auto cursor = m_cursor;
+
+                for (auto i = m_values.size(); i < index && cursor != m_end; ++i) {
+                    ++cursor;
+                }
+
+                overflow = maybe<enumerable_iterator<Type>>(cursor);
+            }
+
+            return nullptr;
+        }
+
+        const enumerable_iterator<Type>& end(void) const
+        {
+            return m_end;
+        }
+
+    private:
+        bool fill(std::size_t index)
+        {
+            while (m_values.size() <= index && !m_done && m_values.size() < m_limit) {
+                if (m_cursor == m_end) {
+                    m_done = true;
+                    break;
+                }
+
+                m_values.push_back(*m_cursor);
+                ++m_cursor;
+            }
+
+            if (m_done || m_values.size() >= m_limit) {
+                m_sealed.store(true, std::memory_order_release);
+            }
+
+            return index < m_values.size();
+        }
+    };
+
+    template <typename Type>
+    class buffer_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    private:
+        typedef buffer_iterator<Type> Self;
+
+    private:
+        std::shared_ptr<buffer_state<Type>> m_state;
+        std::size_t m_index;
+        mutable bool m_resolved;        // m_value and m_overflow describe m_index
+        mutable const Type* m_value;
+        mutable maybe<enumerable_iterator<Type>> m_overflow;
+
+    public:
+        static const char* stage(void)
+        {
+            return "buffer";
+        }
+
+        buffer_iterator(const std::shared_ptr<buffer_state<Type>>& state, std::size_t index) :
+            m_state(state),
+            m_index(index),
+            m_resolved(false),
+            m_value(nullptr)
+        {
+        }
+
+        Self& operator++()
+        {
+            resolve();
+
+            if (m_overflow) {
+                ++*m_overflow;
+            } else {
+                m_resolved = false;
+                m_value = nullptr;
+            }
+
+            ++m_index;
+            return *this;
+        }
+
+        Self operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        Type operator*() const
+        {
+            resolve();
+
+            if (m_value) {
+                return *m_value;
+            }
+
+            if (!m_overflow) {
+                throw enumerable_exception("dereference the end of a buffer");
+            }
+
+            return **m_overflow;
+        }
+
+        bool operator==(const Self& rhs) const
+        {
+            auto at_end = finished();
+            auto rhs_at_end = rhs.finished();
+
+            if (at_end || rhs_at_end) {
+                return at_end == rhs_at_end;
+            }
+
+            return m_index == rhs.m_index;
+        }
+
+        bool operator!=(const Self& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the start is looked up, and a start past the cache copies the cursor, before the iterator is shared */
+        void ensure(void) const
+        {
+            resolve();
+        }
+
+    private:
+        /* one lookup per position, shared by the comparison, dereference and increment on it */
+        void resolve(void) const
+        {
+            if (!m_resolved && m_index != std::size_t(-1)) {
+                m_value = m_state->lookup(m_index, m_overflow);
+                m_resolved = true;
+            }
+        }
+
+        bool finished(void) const
+        {
+            if (m_index == std::size_t(-1)) {
+                return true;
+            }
+
+            resolve();
+
+            if (m_value) {
+                return false;
+            }
+
+            return !m_overflow || *m_overflow == m_state->end();
+        }
+    };
+
+    template <typename Type>
+    buffer_iterator<Type> make_buffer_iterator(const std::shared_ptr<buffer_state<Type>>& state, std::size_t index)
+    {
+        return buffer_iterator<Type>(state, index);
+    }
+
+    /* random */
+    /* splitmix64, spreads one 64-bit seed over the state of the engines below */
+    inline std::uint64_t splitmix64(std::uint64_t& state)
+    {
+        std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
     }
 
-    template <typename Type>
-    class take_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef take_iterator<Type> Self;
+    /*
+     * xoshiro256** (Blackman, Vigna): 256 bits of state and a handful of shifts and rotates
+     * per 64-bit value; the default engine of from_random. min() and max() are constexpr so
+     * the engines also drive the std:: distributions
+     */
+    class xoshiro256ss {
+    public:
+        typedef std::uint64_t result_type;
+
+        explicit xoshiro256ss(std::uint64_t value = 0)
+        {
+            seed(value);
+        }
+
+        void seed(std::uint64_t value)
+        {
+            for (auto& word : m_state) {
+                word = splitmix64(value);
+            }
+        }
+
+        static constexpr result_type min(void)
+        {
+            return 0;
+        }
+
+        static constexpr result_type max(void)
+        {
+            return ~result_type(0);
+        }
+
+        result_type operator()(void)
+        {
+            const std::uint64_t result = rotate(m_state[1] * 5, 7) * 9;
+            const std::uint64_t t = m_state[1] << 17;
+
+            m_state[2] ^= m_state[0];
+            m_state[3] ^= m_state[1];
+            m_state[1] ^= m_state[2];
+            m_state[0] ^= m_state[3];
+            m_state[2] ^= t;
+            m_state[3] = rotate(m_state[3], 45);
+
+            return result;
+        }
+
+    private:
+        static std::uint64_t rotate(std::uint64_t x, int k)
+        {
+            return (x << k) | (x >> (64 - k));
+        }
+
+    private:
+        std::uint64_t m_state[4];
+    };
+
+    /* PCG32, XSH RR variant (O'Neill): 64 bits of state, 32-bit values */
+    class pcg32 {
+    public:
+        typedef std::uint32_t result_type;
+
+        explicit pcg32(std::uint64_t value = 0)
+        {
+            seed(value);
+        }
+
+        void seed(std::uint64_t value)
+        {
+            m_increment = (splitmix64(value) << 1) | 1;
+            m_state = 0;
+            (*this)();
+            m_state += splitmix64(value);
+            (*this)();
+        }
+
+        static constexpr result_type min(void)
+        {
+            return 0;
+        }
+
+        static constexpr result_type max(void)
+        {
+            return ~result_type(0);
+        }
+
+        result_type operator()(void)
+        {
+            std::uint64_t old = m_state;
+            m_state = old * 6364136223846793005ULL + m_increment;
+
+            std::uint32_t shifted = static_cast<std::uint32_t>(((old >> 18) ^ old) >> 27);
+            std::uint32_t rotation = static_cast<std::uint32_t>(old >> 59);
+
+            return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+        }
+
+    private:
+        std::uint64_t m_state;
+        std::uint64_t m_increment;
+    };
+
+    /* how from_random seeds an engine; std::random_device cannot be seeded nor replayed */
+    template <typename Engine>
+    struct random_engine_traits {
+        /* what a block keeps to draw the block after it */
+        typedef Engine state;
+
+        /* the full 64 bits reach the engine; a prvalue, so no seed_seq overload is picked */
+        static void seed(state& engine, std::uint64_t seed)
+        {
+            engine.seed(static_cast<std::uint64_t>(seed));
+        }
+
+        static Engine& engine(state& engine)
+        {
+            return engine;
+        }
+    };
+
+    /* a device has no state worth copying and cannot be copied: every thread reads its own */
+    template <>
+    struct random_engine_traits<std::random_device> {
+        struct state {
+        };
+
+        static void seed(state&, std::uint64_t)
+        {
+        }
+
+        static std::random_device& engine(state&)
+        {
+            static thread_local std::random_device device;
+            return device;
+        }
+    };
 
-    private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_begin;
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
-        int m_count;
-        int m_current;
+    /* 64 random bits from an engine producing 32 or 64 */
+    template <typename Engine>
+    std::uint64_t random_bits(Engine& engine)
+    {
+        static_assert(Engine::min() == 0 && (Engine::max() == 0xffffffffULL || Engine::max() == ~0ULL), "engine must produce full 32 or 64-bit values");
+
+        if (Engine::max() == 0xffffffffULL) {
+            std::uint64_t high = engine();
+            return (high << 32) | static_cast<std::uint64_t>(engine());
+        }
 
+        return static_cast<std::uint64_t>(engine());
+    }
+
+    /*
+     * distributions for from_random, computed the same way on every standard library so a seed
+     * gives the same values everywhere. std:: distributions work too, without that guarantee
+     */
+
+    /* uniform integer in [low, high], without modulo bias */
+    template <typename Type = int>
+    class uniform_int {
     public:
-        template <typename Iterator>
-        take_iterator(const Iterator& begin, const Iterator& end, int count) :
-            m_begin(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(begin)),
-            m_end(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(end)),
-            m_count(count),
-            m_current(0)
+        typedef Type result_type;
+
+        uniform_int(Type low, Type high) :
+            m_low(low),
+            m_range(static_cast<std::uint64_t>(high) - static_cast<std::uint64_t>(low))
         {
-            if (m_current == m_count) {
-                m_begin = m_end;
-            }
         }
 
-        Self& operator++()
+        template <typename Engine>
+        Type operator()(Engine& engine) const
         {
-            if (++m_current == m_count) {
-                m_begin = m_end;
+            if (m_range == ~0ULL) {
+                return static_cast<Type>(random_bits(engine));
+            }
 
-            } else {
-                m_begin = m_begin->next();
+            const std::uint64_t count = m_range + 1;
+
+            /* Lemire: the high half of a 32 x 32 bit product, rejecting the biased low end */
+            if (count <= 0xffffffffULL) {
+                std::uint64_t product = (random_bits(engine) >> 32) * count;
+
+                if ((product & 0xffffffffULL) < count) {
+                    const std::uint64_t threshold = (0x100000000ULL - count) % count;
+
+                    while ((product & 0xffffffffULL) < threshold) {
+                        product = (random_bits(engine) >> 32) * count;
+                    }
+                }
+
+                return static_cast<Type>(static_cast<std::uint64_t>(m_low) + (product >> 32));
             }
-            return *this;
+
+            std::uint64_t mask = m_range;
+
+            for (int shift = 1; shift < 64; shift <<= 1) {
+                mask |= mask >> shift;
+            }
+
+            std::uint64_t value;
+
+            do {
+                value = random_bits(engine) & mask;
+            } while (value > m_range);
+
+            return static_cast<Type>(static_cast<std::uint64_t>(m_low) + value);
         }
 
-        Self operator++(int)
-        {
-            auto temp = *this;
+    private:
+        Type m_low;
+        std::uint64_t m_range;
+    };
 
-            if (++m_current == m_count) {
-                m_begin = m_end;
+    /* uniform real in [low, high), 53 random bits per value */
+    template <typename Type = double>
+    class uniform_real {
+    public:
+        typedef Type result_type;
 
-            } else {
-                m_begin = m_begin->next();
-            }
+        uniform_real(Type low, Type high) :
+            m_low(low),
+            m_width(high - low)
+        {
+        }
 
-            return temp;
+        template <typename Engine>
+        Type operator()(Engine& engine) const
+        {
+            return m_low + m_width * static_cast<Type>(static_cast<double>(random_bits(engine) >> 11) * (1.0 / 9007199254740992.0));
         }
 
-        Type operator*() const
+    private:
+        Type m_low;
+        Type m_width;
+    };
+
+    /* normal with the given mean and standard deviation, Marsaglia's polar method */
+    template <typename Type = double>
+    class normal {
+    public:
+        typedef Type result_type;
+
+        normal(Type mean, Type deviation) :
+            m_mean(mean),
+            m_deviation(deviation),
+            m_cached(false),
+            m_spare(0)
         {
-            return m_begin->value();
         }
 
-        bool operator==(const Self& rhs) const
+        template <typename Engine>
+        Type operator()(Engine& engine)
         {
-            return m_begin->equals(rhs.m_begin);
+            if (m_cached) {
+                m_cached = false;
+                return m_mean + m_deviation * static_cast<Type>(m_spare);
+            }
+
+            uniform_real<double> unit(-1, 1);
+            double x, y, s;
+
+            do {
+                x = unit(engine);
+                y = unit(engine);
+                s = x * x + y * y;
+            } while (s >= 1 || s == 0);
+
+            double scale = std::sqrt(-2 * std::log(s) / s);
+
+            m_spare = y * scale;
+            m_cached = true;
+            return m_mean + m_deviation * static_cast<Type>(x * scale);
         }
 
-        bool operator!=(const Self& rhs) const
+    private:
+        Type m_mean;
+        Type m_deviation;
+        bool m_cached;
+        double m_spare;
+    };
+
+    /* the engine from_random runs and its seed */
+    template <typename Engine>
+    struct random_policy {
+        explicit random_policy(std::uint64_t seed) :
+            seed(seed)
         {
-            return !m_begin->equals(rhs.m_begin);
         }
+
+        std::uint64_t seed;
     };
 
-    template <typename Iterator, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    take_iterator<Type> make_take_iterator(const Iterator& begin, const Iterator& end, int count)
+    template <typename Engine = xoshiro256ss>
+    inline random_policy<Engine> seeded(std::uint64_t seed)
     {
-        return take_iterator<Type>(begin, end, count);
+        return random_policy<Engine>(seed);
     }
 
-    template <typename Type, typename Functor>
-    class take_while_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef take_while_iterator<Type, Functor> Self;
+    /* a fresh seed from std::random_device, for queries that need not repeat */
+    template <typename Engine = xoshiro256ss>
+    inline random_policy<Engine> unseeded(void)
+    {
+        std::random_device device;
+        std::uint64_t high = device();
+        return random_policy<Engine>((high << 32) ^ device());
+    }
+
+    /* every value straight from std::random_device: slow, never repeats */
+    inline random_policy<std::random_device> entropy(void)
+    {
+        return random_policy<std::random_device>(0);
+    }
+
+    /* the raw output of the engine */
+    struct random_raw {
+        template <typename Engine>
+        typename Engine::result_type operator()(Engine& engine) const
+        {
+            return engine();
+        }
+    };
 
+    /*
+     * from_random values, generated a block at a time. a block keeps the engine and generator as
+     * they were after drawing it, so the next block is drawn from that snapshot instead of by
+     * replaying from the seed. blocks never change once drawn and are shared by the iterators
+     * standing in them, so every pass of a seeded query sees the same values
+     */
+    template <typename Engine, typename Generator, typename Type>
+    class random_block {
     private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_begin;
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
-        Functor m_predicate;
+        typedef random_engine_traits<Engine> Traits;
 
     public:
-        template <typename Iterator>
-        take_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate) :
-            m_begin(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(begin)),
-            m_end(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(end)),
-            m_predicate(predicate)
+        enum { block_size = 256 };
+
+        /* the empty block before the first, holding the seeded engine */
+        random_block(std::uint64_t seed, const Generator& generator) :
+            m_generator(generator)
         {
-            if (!m_begin->equals(m_end) && !m_predicate(m_begin->value())) {
-                m_begin = m_end;
-            }
+            Traits::seed(m_state, seed);
         }
 
-        Self& operator++()
+        random_block(const typename Traits::state& state, const Generator& generator) :
+            m_state(state),
+            m_generator(generator)
         {
-            m_begin = m_begin->next();
-            if (!m_predicate(m_begin->value())) {
-                m_begin = m_end;
-            }
-            return *this;
         }
 
-        Self operator++(int)
+        std::shared_ptr<const random_block> next(void) const
         {
-            auto temp = *this;
-            m_begin = m_begin->next();
-            if (!m_predicate(m_begin->value())) {
-                m_begin = m_end;
+            auto block = make_counted<random_block>(m_state, m_generator);
+            auto& engine = Traits::engine(block->m_state);
+
+            block->m_values.reserve(block_size);
+
+            for (std::size_t i = 0; i < block_size; ++i) {
+                block->m_values.push_back(block->m_generator(engine));
             }
-            return temp;
-        }
 
-        Type operator*() const
-        {
-            return m_begin->value();
+            return block;
         }
 
-        bool operator==(const Self& rhs) const
+        std::size_t size(void) const
         {
-            return m_begin->equals(rhs.m_begin);
+            return m_values.size();
         }
 
-        bool operator!=(const Self& rhs) const
+        const Type& operator[](std::size_t index) const
         {
-            return !m_begin->equals(rhs.m_begin);
+            return m_values[index];
         }
-    };
-
-    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    take_while_iterator<Type, Functor> make_take_while_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate)
-    {
-        return take_while_iterator<Type, Functor>(begin, end, predicate);
-    }
 
-    template <typename Type, typename Functor>
-    class where_iterator : public std::iterator<std::forward_iterator_tag, Type> {
     private:
-        typedef where_iterator<Type, Functor> Self;
+        typename Traits::state m_state;
+        Generator m_generator;
+        std::vector<Type> m_values;
+    };
 
+    template <typename Type, typename Block, typename Functor>
+    class random_iterator : public std::iterator<std::forward_iterator_tag, Type> {
     private:
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_begin;
-        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
-        Functor m_predicate;
+        typedef random_iterator<Type, Block, Functor> Self;
 
+    private:
+        mutable std::shared_ptr<const Block> m_block;
+        mutable std::size_t m_offset;
+        bool m_flag;
+        Functor m_selector;
     public:
-        template <typename Iterator>
-        where_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate) :
-            m_begin(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(begin)),
-            m_end(std::make_shared<typename iterator_wrap<Type>::template holder<Iterator>>(end)),
-            m_predicate(predicate)
+        static const char* stage(void)
+        {
+            return "random";
+        }
+
+        random_iterator(const std::shared_ptr<const Block>& block, bool flag, const Functor& selector) : 
+            m_block(block), 
+            m_offset(0),
+            m_flag(flag),
+            m_selector(selector)
         {
-            where(false);
         }
 
         Self& operator++()
         {
-            where(true);
+            ensure();
+
+            if (++m_offset == m_block->size()) {
+                m_block = m_block->next();
+                m_offset = 0;
+            }
+
             return *this;
         }
 
         Self operator++(int)
         {
-            auto temp = *this;
-            where(true);
-            return temp;
+            auto it = *this;
+            ++*this;
+            return it;
         }
 
-        Type operator*() const
+        typename functor_retriver<decltype(&Functor::operator())>::type operator*() const
         {
-            return m_begin->value();
+            ensure();
+            return m_selector((*m_block)[m_offset]);
         }
 
         bool operator==(const Self& rhs) const
         {
-            return m_begin->equals(rhs.m_begin);
+            return m_flag == rhs.m_flag;
         }
 
         bool operator!=(const Self& rhs) const
         {
-            return !m_begin->equals(rhs.m_begin);
+            return m_flag != rhs.m_flag;
         }
 
-    private:
-        void where(bool next)
+    public:
+        /* the first block is drawn on first use */
+        void ensure(void) const
         {
-            if (m_begin->equals(m_end)) {
-                return;
-            }
-
-            if (next) {
-                m_begin = m_begin->next();
-            }
-
-            while (!m_begin->equals(m_end) && !m_predicate(m_begin->value())) {
-                m_begin = m_begin->next();
+            if (!m_flag && m_offset == m_block->size()) {
+                m_block = m_block->next();
+                m_offset = 0;
             }
         }
     };
 
-    template <typename Iterator, typename Functor, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
-    where_iterator<Type, Functor> make_where_iterator(const Iterator& begin, const Iterator& end, const Functor& predicate)
+    template <typename Type, typename Block, typename Functor>
+    random_iterator<Type, Block, Functor> make_random_iterator(const std::shared_ptr<const Block>& block, bool flag, const Functor& selector)
     {
-        return where_iterator<Type, Functor>(begin, end, predicate);
+        return random_iterator<Type, Block, Functor>(block, flag, selector);
     }
 
-    template <typename LeftType, typename RightType>
-    class zip_iterator : public std::iterator<std::forward_iterator_tag, std::pair<LeftType, RightType>> {
+    /*
+     * the element at each index of a sequence computed on the fly, generator(index), as a
+     * random access iterator: range and repeat report their size, skip and index in O(1),
+     * reverse in place and split by index across sb::parallel workers without storing anything
+     */
+    template <typename Type, typename Generator>
+    class index_iterator : public std::iterator<std::random_access_iterator_tag, Type, std::ptrdiff_t, const Type*, Type> {
     private:
-        typedef zip_iterator<LeftType, RightType> Self;
+        typedef index_iterator<Type, Generator> Self;
 
     private:
-        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_begin;
-        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_end;
-        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_begin;
-        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_end;
+        Generator m_generator;
+        std::ptrdiff_t m_index;
 
     public:
-        template <typename LeftIterator, typename RightIterator>
-        zip_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end) :
-            m_left_begin(std::make_shared<typename iterator_wrap<LeftType>::template holder<LeftIterator>>(left_begin)),
-            m_left_end(std::make_shared<typename iterator_wrap<LeftType>::template holder<LeftIterator>>(left_end)),
-            m_right_begin(std::make_shared<typename iterator_wrap<RightType>::template holder<RightIterator>>(right_begin)),
-            m_right_end(std::make_shared<typename iterator_wrap<RightType>::template holder<RightIterator>>(right_end))
+        static const char* stage(void)
         {
+            return Generator::stage();
         }
 
-        Self& operator++()
+        index_iterator(const Generator& generator, std::ptrdiff_t index) :
+            m_generator(generator),
+            m_index(index)
         {
-            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
-                m_left_begin = m_left_begin->next();
-                m_right_begin = m_right_begin->next();
-            }
+        }
 
+        Self& operator++()
+        {
+            ++m_index;
             return *this;
         }
 
         Self operator++(int)
         {
-            auto temp = *this;
-
-            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
-                m_left_begin = m_left_begin->next();
-                m_right_begin = m_right_begin->next();
-            }
-
-            return temp;
+            auto it = *this;
+            ++m_index;
+            return it;
         }
 
-        std::pair<LeftType, RightType> operator*() const
+        Self& operator--()
         {
-            return std::make_pair(m_left_begin->value(), m_right_begin->value());
+            --m_index;
+            return *this;
         }
 
-        bool operator==(const Self& rhs) const
+        Self operator--(int)
         {
-            return m_left_begin->equals(rhs.m_left_begin) && m_right_begin->equals(rhs.m_right_begin);
+            auto it = *this;
+            --m_index;
+            return it;
         }
 
-        bool operator!=(const Self& rhs) const
+        Self& operator+=(std::ptrdiff_t offset)
         {
-            return !m_left_begin->equals(rhs.m_left_begin) && !m_right_begin->equals(rhs.m_right_begin);
+            m_index += offset;
+            return *this;
         }
-    };
 
-    template <typename LeftIterator,
-              typename RightIterator,
-              typename LeftType = typename recover_type<typename std::iterator_traits<LeftIterator>::value_type>::type,
-              typename RightType = typename recover_type<typename std::iterator_traits<RightIterator>::value_type>::type>
-    zip_iterator<LeftType, RightType> make_zip_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end)
-    {
-        return zip_iterator<LeftType, RightType>(
-            left_begin,
-            left_end,
-            right_begin,
-            right_end
-            );
-    }
+        Self& operator-=(std::ptrdiff_t offset)
+        {
+            m_index -= offset;
+            return *this;
+        }
 
-    template <typename KeyType, typename LeftType, typename RightType, typename Functor>
-    class zip_with_iterator : public std::iterator<std::forward_iterator_tag, std::pair<LeftType, RightType>> {
-    private:
-        typedef zip_with_iterator<KeyType, LeftType, RightType, Functor> Self;
+        Self operator+(std::ptrdiff_t offset) const
+        {
+            return Self(m_generator, m_index + offset);
+        }
 
-    private:
-        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_begin;
-        std::shared_ptr<typename iterator_wrap<LeftType>::placeholder>  m_left_end;
-        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_begin;
-        std::shared_ptr<typename iterator_wrap<RightType>::placeholder> m_right_end;
-        Functor m_selector;
+        Self operator-(std::ptrdiff_t offset) const
+        {
+            return Self(m_generator, m_index - offset);
+        }
 
-    public:
-        template <typename LeftIterator, typename RightIterator>
-        zip_with_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end, const Functor& selector) :
-            m_left_begin(std::make_shared<typename iterator_wrap<LeftType>::template holder<LeftIterator>>(left_begin)),
-            m_left_end(std::make_shared<typename iterator_wrap<LeftType>::template holder<LeftIterator>>(left_end)),
-            m_right_begin(std::make_shared<typename iterator_wrap<RightType>::template holder<RightIterator>>(right_begin)),
-            m_right_end(std::make_shared<typename iterator_wrap<RightType>::template holder<RightIterator>>(right_end)),
-            m_selector(selector)
+        std::ptrdiff_t operator-(const Self& rhs) const
         {
+            return m_index - rhs.m_index;
         }
 
-        Self& operator++()
+        Type operator*() const
         {
-            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
-                m_left_begin = m_left_begin->next();
-                m_right_begin = m_right_begin->next();
-            }
+            return m_generator(m_index);
+        }
 
-            return *this;
+        Type operator[](std::ptrdiff_t offset) const
+        {
+            return m_generator(m_index + offset);
         }
 
-        Self operator++(int)
+        bool operator==(const Self& rhs) const
         {
-            auto temp = *this;
+            return m_index == rhs.m_index;
+        }
 
-            if (!m_left_begin->equals(m_left_end) && !m_right_begin->equals(m_right_end)) {
-                m_left_begin = m_left_begin->next();
-                m_right_begin = m_right_begin->next();
-            }
+        bool operator!=(const Self& rhs) const
+        {
+            return m_index != rhs.m_index;
+        }
 
-            return temp;
+        bool operator<(const Self& rhs) const
+        {
+            return m_index < rhs.m_index;
         }
 
-        std::pair<KeyType, RightType> operator*() const
+        bool operator>(const Self& rhs) const
         {
-            return std::make_pair(m_selector(m_left_begin->value(), m_right_begin->value()), m_right_begin->value());
+            return m_index > rhs.m_index;
         }
 
-        bool operator==(const Self& rhs) const
+        bool operator<=(const Self& rhs) const
         {
-            return m_left_begin->equals(rhs.m_left_begin) && m_right_begin->equals(rhs.m_right_begin);
+            return m_index <= rhs.m_index;
         }
 
-        bool operator!=(const Self& rhs) const
+        bool operator>=(const Self& rhs) const
         {
-            return !m_left_begin->equals(rhs.m_left_begin) && !m_right_begin->equals(rhs.m_right_begin);
+            return m_index >= rhs.m_index;
         }
     };
 
-    template <typename LeftIterator,
-              typename RightIterator,
-              typename Functor,
-              typename KeyType = typename functor_retriver<decltype(&Functor::operator())>::type,
-              typename LeftType = typename recover_type<typename std::iterator_traits<LeftIterator>::value_type>::type,
-              typename RightType = typename recover_type<typename std::iterator_traits<RightIterator>::value_type>::type>
-    zip_with_iterator<KeyType, LeftType, RightType, Functor> make_zip_with_iterator(const LeftIterator& left_begin, const LeftIterator& left_end, const RightIterator& right_begin, const RightIterator& right_end, const Functor& selector)
+    template <typename Type, typename Generator>
+    index_iterator<Type, Generator> make_index_iterator(const Generator& generator, std::ptrdiff_t index)
     {
-        return zip_with_iterator<KeyType, LeftType, RightType, Functor>(
-            left_begin,
-            left_end,
-            right_begin,
-            right_end,
-            selector
-            );
+        return index_iterator<Type, Generator>(generator, index);
     }
 
+    /* start + index * step */
     template <typename Type>
-    class empty_iterator : public std::iterator<std::forward_iterator_tag, Type> {
-    private:
-        typedef empty_iterator<Type> Self;
-
-    public:
-        empty_iterator()
+    struct range_generator {
+        static const char* stage(void)
         {
+            return "range";
         }
 
-        Self& operator++()
+        Type operator()(std::ptrdiff_t index) const
         {
-            return *this;
+            return static_cast<Type>(start + static_cast<Type>(index) * step);
         }
 
-        Self operator++(int)
-        {
-            return *this;
-        }
+        Type start;
+        Type step;
+    };
 
-        Type operator*() const
+    /* the same value at every index, shared rather than copied with the iterator */
+    template <typename Type>
+    struct repeat_generator {
+        static const char* stage(void)
         {
-            throw enumerable_exception("get a value from an empty collection");
+            return "repeat";
         }
 
-        bool operator==(const Self& rhs) const
+        Type operator()(std::ptrdiff_t) const
         {
-            return true;
+            return *value;
         }
 
-        bool operator!=(const Self& rhs) const
-        {
-            return false;
-        }
+        std::shared_ptr<const Type> value;
     };
 
-    template <typename Type>
-    empty_iterator<Type> make_empty_iterator(void)
-    {
-        return empty_iterator<Type>();
-    }
-
-    template <typename Type, typename Functor>
-    class random_iterator : public std::iterator<std::forward_iterator_tag, Type> {
+    /*
+     * Bernoulli sampling without a draw per element: the gap to the next kept element is
+     * geometric, so the source is only stepped over between kept elements. the engine is held
+     * by value, so a copied iterator replays the same choices
+     */
+    template <typename Type, typename Engine>
+    class sample_iterator : public std::iterator<std::forward_iterator_tag, Type> {
     private:
-        typedef random_iterator<Type, Functor> Self;
+        typedef sample_iterator<Type, Engine> Self;
 
     private:
-        std::shared_ptr<std::random_device> m_rd;
-        bool m_flag;
-        Functor m_selector;
+        mutable std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_begin;
+        std::shared_ptr<typename iterator_wrap<Type>::placeholder> m_end;
+        mutable Engine m_engine;
+        double m_fraction;
+        mutable bool m_ready;
+
     public:
-        random_iterator(bool flag, const Functor& selector) : 
-            m_rd(std::make_shared<std::random_device>()), 
-            m_flag(flag),
-            m_selector(selector)
+        static const char* stage(void)
+        {
+            return "sample_fraction";
+        }
+
+        template <typename Iterator>
+        sample_iterator(const Iterator& begin, const Iterator& end, double fraction, const Engine& engine) :
+            m_begin(make_placeholder<Type>(begin)),
+            m_end(make_placeholder<Type>(end)),
+            m_engine(engine),
+            m_fraction(fraction),
+            m_ready(false)
         {
         }
 
         Self& operator++()
         {
+            ensure();
+            skip(true);
             return *this;
         }
 
         Self operator++(int)
         {
-            return *this;
+            auto temp = *this;
+            ++*this;
+            return temp;
         }
 
-        typename functor_retriver<decltype(&Functor::operator())>::type operator*() const
+        Type operator*() const
         {
-            return m_selector((*m_rd)());
+            ensure();
+            return m_begin->value();
         }
 
         bool operator==(const Self& rhs) const
         {
-            return m_flag == rhs.m_flag;
+            ensure();
+            rhs.ensure();
+            return m_begin->equals(rhs.m_begin);
         }
 
         bool operator!=(const Self& rhs) const
         {
-            return m_flag != rhs.m_flag;
+            return !(*this == rhs);
+        }
+
+    public:
+        /* the first gap is drawn on first use */
+        void ensure(void) const
+        {
+            if (!m_ready) {
+                skip(false);
+                m_ready = true;
+            }
+        }
+
+    private:
+        void skip(bool next) const
+        {
+            if (m_begin->equals(m_end)) {
+                return;
+            }
+
+            std::uint64_t gap = next ? 1 : 0;
+
+            if (m_fraction <= 0) {
+                gap = ~std::uint64_t(0);
+
+            } else if (m_fraction < 1) {
+                double u = 1 - uniform_real<double>(0, 1)(m_engine);
+                double draw = std::floor(std::log(u) / std::log1p(-m_fraction));
+                gap += draw < 1.8e19 ? static_cast<std::uint64_t>(draw) : ~std::uint64_t(0);
+            }
+
+            for (; gap > 0 && !m_begin->equals(m_end); --gap) {
+                m_begin = m_begin->next();
+            }
         }
     };
 
-    template <typename Type, typename Functor>
-    random_iterator<Type, Functor> make_random_iterator(bool flag, const Functor& selector)
+    template <typename Iterator, typename Engine, typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
+    sample_iterator<Type, Engine> make_sample_iterator(const Iterator& begin, const Iterator& end, double fraction, const Engine& engine)
     {
-        return random_iterator<Type, Functor>(flag, selector);
+        return sample_iterator<Type, Engine>(begin, end, fraction, engine);
     }
 
     /* interface */
     template <typename Type>
     class enumerable;
 
+    /* endless values of generator(engine), engine seeded by policy, each passed through selector */
+    template <typename Type, typename Engine, typename Generator, typename Functor>
+    inline enumerable<Type> random_source(const random_policy<Engine>& policy, const Generator& generator, const Functor& selector)
+    {
+        typedef random_block<Engine, Generator, typename std::decay<decltype(std::declval<Generator&>()(std::declval<Engine&>()))>::type> Block;
+
+        std::shared_ptr<const Block> seed = make_counted<Block>(policy.seed, generator);
+
+        return plan_access::attach(enumerable<Type>(
+            make_random_iterator<Type>(seed, false, selector),
+            make_random_iterator<Type>(seed, true, selector)
+            ), make_plan("from_random"));
+    }
+
+    template <typename Type, typename Engine>
+    inline enumerable<Type> from_random(const random_policy<Engine>& policy)
+    {
+        return random_source<Type>(policy, random_raw(), [](const typename Engine::result_type& x) { return static_cast<Type>(x); });
+    }
+
     template <typename Type>
     inline enumerable<Type> from_random(void) 
     {
-        auto selector = [](const Type& x){return x;};
-        typedef decltype(selector) Functor;
-        return enumerable<Type>(
-            make_random_iterator<Type, Functor>(false, selector),
-            make_random_iterator<Type, Functor>(true, selector)
-            );
+        return from_random<Type>(unseeded());
     }
 
     template <typename Type, typename Functor>
     inline enumerable<Type> from_random(const Functor& selector) 
     {
-        return enumerable<Type>(
-            make_random_iterator<Type, Functor>(false, selector),
-            make_random_iterator<Type, Functor>(true, selector)
-            );
+        return random_source<Type>(unseeded(), random_raw(), selector);
+    }
+
+    template <typename Distribution, typename Engine>
+    inline enumerable<typename Distribution::result_type> from_random(const Distribution& distribution, const random_policy<Engine>& policy)
+    {
+        typedef typename Distribution::result_type Type;
+        return random_source<Type>(policy, distribution, [](const Type& x) { return x; });
+    }
+
+    template <typename Distribution>
+    inline enumerable<typename Distribution::result_type> from_random(const Distribution& distribution)
+    {
+        return from_random(distribution, unseeded());
+    }
+
+    /* count values start, start + step, ... computed when read, without storage */
+    template <typename Type>
+    inline enumerable<Type> range(Type start, std::size_t count, const typename std::decay<Type>::type& step = 1)
+    {
+        range_generator<Type> generator = { start, step };
+        auto begin = make_index_iterator<Type>(generator, 0);
+        auto end = make_index_iterator<Type>(generator, static_cast<std::ptrdiff_t>(count));
+
+        return plan_access::attach(enumerable<Type>(
+            make_enumerable_iterator(begin),
+            make_enumerable_iterator(end),
+            make_source<Type>(begin, end)
+            ), make_plan("range"));
+    }
+
+    /* value, count times, without storing count copies */
+    template <typename Type>
+    inline enumerable<Type> repeat(const Type& value, std::size_t count)
+    {
+        repeat_generator<Type> generator = { make_counted<const Type>(value) };
+        auto begin = make_index_iterator<Type>(generator, 0);
+        auto end = make_index_iterator<Type>(generator, static_cast<std::ptrdiff_t>(count));
+
+        return plan_access::attach(enumerable<Type>(
+            make_enumerable_iterator(begin),
+            make_enumerable_iterator(end),
+            make_source<Type>(begin, end)
+            ), make_plan("repeat"));
     }
 
     template <typename Iterator, 
               typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
     inline enumerable<Type> from(const Iterator& begin, const Iterator& end)
     {
-        return enumerable<Type> (
+        return plan_access::attach(enumerable<Type> (
             make_enumerable_iterator(begin), 
-            make_enumerable_iterator(end)
-            );
+            make_enumerable_iterator(end),
+            make_source<Type>(begin, end)
+            ), make_plan("from"));
     }
 
     template <typename Container>
@@ -941,24 +4815,68 @@ namespace sb {
             );
     }
 
-    template <typename Type>
-    inline enumerable<Type> from(const std::initializer_list<Type>& container)
+    /* [begin, end) of a range kept alive by owner, if any */
+    template <typename Type, typename Iterator>
+    inline enumerable<Type> from_view(const Iterator& begin, const Iterator& end, const std::shared_ptr<void>& owner)
     {
-        return from (
-            make_enumerable_iterator(std::begin(container)),
-            make_enumerable_iterator(std::end(container))
+        if (!owner) {
+            return enumerable<Type>(
+                enumerable_iterator<Type>(begin),
+                enumerable_iterator<Type>(end),
+                make_source<Type>(begin, end)
+                );
+        }
+
+        return enumerable<Type>(
+            make_storage_iterator(owner, begin),
+            make_storage_iterator(owner, end),
+            make_source<Type>(begin, end, owner)
             );
     }
 
+    /* owned: the container was made for this query, so an expiring query may hand it over */
+    template <typename Type, typename Container>
+    inline enumerable<Type> from_storage(const std::shared_ptr<Container>& container, bool = true)
+    {
+        return enumerable<Type>(
+            make_storage_iterator(container, std::begin(*container)),
+            make_storage_iterator(container, std::end(*container)),
+            make_source<Type>(std::begin(*container), std::end(*container), container)
+            );
+    }
+
+    template <typename Type>
+    inline enumerable<Type> from_storage(const std::shared_ptr<std::vector<Type>>& container, bool owned = true)
+    {
+        return enumerable<Type>(container, owned);
+    }
+
+    template <typename Type>
+    struct is_enumerable : std::false_type {
+    };
+
+    template <typename Type>
+    struct is_enumerable<enumerable<Type>> : std::true_type {
+    };
+
+    /* a range passed as an rvalue, which must be moved into storage the query owns */
+    template <typename Container>
+    struct is_temporary_range : std::integral_constant<bool, is_range<Container>::value && !std::is_reference<Container>::value && !is_enumerable<Container>::value> {
+    };
+
+    /* a temporary container is moved into storage owned by the query instead of being referenced */
+    template <typename Container, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+    inline auto from(Container&& container) ->
+        enumerable<typename recover_type<decltype(*std::begin(container))>::type>
+    {
+        return plan_access::attach(from_storage<typename recover_type<decltype(*std::begin(container))>::type>(make_counted<Container>(std::move(container))), make_plan("from"));
+    }
+
     template <typename Iterator, 
               typename Type = typename recover_type<typename std::iterator_traits<Iterator>::value_type>::type>
     inline enumerable<Type> from_values(const Iterator& begin, const Iterator& end)
     {
-        auto ptr = std::make_shared<std::vector<Type>>(begin, end);
-        return from (
-            make_storage_iterator(ptr, ptr->begin()),
-            make_storage_iterator(ptr, ptr->end())
-            );
+        return plan_access::attach(from_storage<Type>(make_counted<std::vector<Type>>(begin, end)), make_plan("from_values"));
     }
 
     template <typename Container>
@@ -970,6 +4888,13 @@ namespace sb {
             std::end(container)
             );
     }
+
+    template <typename Container, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+    inline auto from_values(Container&& container) ->
+        enumerable<typename recover_type<decltype(*std::begin(container))>::type>
+    {
+        return plan_access::attach(from_storage<typename recover_type<decltype(*std::begin(container))>::type>(make_counted<Container>(std::move(container))), make_plan("from_values"));
+    }
     
     template<typename Type>
     inline enumerable<Type> from_values(const std::initializer_list<Type>& container)
@@ -980,16 +4905,55 @@ namespace sb {
             );
     }
 
+    /* the list dies with the full expression, so its values are copied */
+    template <typename Type>
+    inline enumerable<Type> from(const std::initializer_list<Type>& container)
+    {
+        return from_values(container);
+    }
+
     template <typename Container>
     inline auto from_values(const std::shared_ptr<Container>& container) -> 
         enumerable<typename recover_type<decltype(*std::begin(*container))>::type>
     {
-        return from (
-            make_storage_iterator(container, std::begin(*container)), 
-            make_storage_iterator(container, std::end(*container))
-            );
+        return from_storage<typename recover_type<decltype(*std::begin(*container))>::type>(container, false);
+    }
+
+    template <typename Type, typename Iterator>
+    inline enumerable<Type> reverse_view(const Iterator& begin, const Iterator& end, const std::shared_ptr<void>& owner)
+    {
+        return from_view<Type>(std::reverse_iterator<Iterator>(end), std::reverse_iterator<Iterator>(begin), owner);
+    }
+
+    template <typename Type, typename Iterator>
+    inline enumerable<Type> reverse_view(const std::reverse_iterator<Iterator>& begin, const std::reverse_iterator<Iterator>& end, const std::shared_ptr<void>& owner)
+    {
+        return from_view<Type>(end.base(), begin.base(), owner);
     }
     
+    template <typename Type>
+    inline enumerable<Type> concat(const std::vector<enumerable<Type>>& ranges)
+    {
+        if (ranges.empty()) {
+            return enumerable<Type>();
+        }
+
+        return ranges.front().concat(std::vector<enumerable<Type>>(ranges.begin() + 1, ranges.end()));
+    }
+
+    /* a range produced by factory the first time it is iterated */
+    template <typename Type, typename Functor>
+    inline enumerable<Type> defer(const Functor& factory)
+    {
+        auto source = make_counted<deferred_source<Type>>(factory);
+
+        return enumerable<Type>(
+            make_deferred_iterator(source, false),
+            make_deferred_iterator(source, true),
+            source
+            );
+    }
+
     /* implement */
     template <typename Type>
     class enumerable {
@@ -999,41 +4963,142 @@ namespace sb {
     private:
         enumerable_iterator<Type>  m_begin;
         enumerable_iterator<Type>  m_end;
+        std::shared_ptr<typename source_wrap<Type>::placeholder> m_source;
+        std::shared_ptr<const std::vector<Self>> m_segments;
+        std::shared_ptr<deferred_source<Type>> m_deferred;
+        std::shared_ptr<std::vector<Type>> m_storage;
+        std::shared_ptr<const plan_node> m_plan;
+        mutable std::atomic<bool> m_owned;     // the storage or deferred result is reachable only through this range
+
+        friend struct plan_access;
 
     public:
         enumerable() : 
             m_begin(enumerable_iterator<Type>(make_empty_iterator<Type>())),
-            m_end(enumerable_iterator<Type>(make_empty_iterator<Type>()))
+            m_end(enumerable_iterator<Type>(make_empty_iterator<Type>())),
+            m_owned(false)
         {
         }
 
         enumerable(const enumerable_iterator<Type>& begin, const enumerable_iterator<Type>& end) : 
             m_begin(begin),
-            m_end(end)
+            m_end(end),
+            m_owned(false)
+        {
+        }
+
+        enumerable(const enumerable_iterator<Type>& begin,
+                   const enumerable_iterator<Type>& end,
+                   const std::shared_ptr<typename source_wrap<Type>::placeholder>& source) :
+            m_begin(begin),
+            m_end(end),
+            m_source(source),
+            m_owned(false)
+        {
+        }
+
+        /* the deferred source is made for this range alone */
+        enumerable(const enumerable_iterator<Type>& begin,
+                   const enumerable_iterator<Type>& end,
+                   const std::shared_ptr<deferred_source<Type>>& deferred) :
+            m_begin(begin),
+            m_end(end),
+            m_deferred(deferred),
+            m_owned(true)
+        {
+        }
+
+        explicit enumerable(const std::shared_ptr<std::vector<Type>>& storage, bool owned = false) :
+            m_begin(make_storage_iterator(storage, storage->cbegin())),
+            m_end(make_storage_iterator(storage, storage->cend())),
+            m_source(make_source<Type>(storage->cbegin(), storage->cend(), storage)),
+            m_storage(storage),
+            m_owned(owned)
+        {
+        }
+
+        /* a copy shares the storage, so neither range owns it any longer */
+        enumerable(const enumerable& rhs) :
+            m_begin(rhs.m_begin),
+            m_end(rhs.m_end),
+            m_source(rhs.m_source),
+            m_segments(rhs.m_segments),
+            m_deferred(rhs.m_deferred),
+            m_storage(rhs.m_storage),
+            m_plan(rhs.m_plan),
+            m_owned(false)
+        {
+            rhs.disown();
+        }
+
+        enumerable(enumerable&& rhs) :
+            m_begin(std::move(rhs.m_begin)),
+            m_end(std::move(rhs.m_end)),
+            m_source(std::move(rhs.m_source)),
+            m_segments(std::move(rhs.m_segments)),
+            m_deferred(std::move(rhs.m_deferred)),
+            m_storage(std::move(rhs.m_storage)),
+            m_plan(std::move(rhs.m_plan)),
+            m_owned(rhs.m_owned.exchange(false))
+        {
+        }
+
+        enumerable& operator=(const enumerable& rhs)
+        {
+            m_begin = rhs.m_begin;
+            m_end = rhs.m_end;
+            m_source = rhs.m_source;
+            m_segments = rhs.m_segments;
+            m_deferred = rhs.m_deferred;
+            m_storage = rhs.m_storage;
+            m_plan = rhs.m_plan;
+            m_owned = false;
+            rhs.disown();
+            return *this;
+        }
+
+        enumerable& operator=(enumerable&& rhs)
         {
+            if (this != &rhs) {
+                m_begin = std::move(rhs.m_begin);
+                m_end = std::move(rhs.m_end);
+                m_source = std::move(rhs.m_source);
+                m_segments = std::move(rhs.m_segments);
+                m_deferred = std::move(rhs.m_deferred);
+                m_storage = std::move(rhs.m_storage);
+                m_plan = std::move(rhs.m_plan);
+                m_owned = rhs.m_owned.exchange(false);
+            }
+
+            return *this;
         }
 
+        /* iterators handed out keep the storage, so the range no longer owns it */
         enumerable_iterator<Type> begin() const
         {
+            disown();
             return m_begin;
         }
 
         enumerable_iterator<Type> end() const
         {
+            disown();
             return m_end;
         }
 
         template <typename Functor>
         Type aggregate(const Functor& reducer) const
         {
-            if (empty()) {
+            auto it = begin();
+            auto last = end();
+
+            if (it == last) {
                 throw enumerable_exception("get a value from an empty collection");
             }
 
-            auto it = begin();
             auto result = *it;
 
-            while(++it != end()) {
+            while(++it != last) {
                 result = reducer(result, *it);
             }
 
@@ -1060,6 +5125,32 @@ namespace sb {
             return selector(aggregate(seed, reducer));
         }
 
+        template <typename KeyFunctor,
+                  typename Functor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, Type>> aggregate_by(const KeyFunctor& key_selector, const Functor& reducer) const
+        {
+            return reduce_by<KeyType, Type>(key_selector, [](const Type& value) { return value; }, reducer);
+        }
+
+        template <typename KeyFunctor,
+                  typename Functor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, Type>>
+            aggregate_by(const KeyFunctor& key_selector, const Functor& reducer, const parallel_policy& policy) const
+        {
+            return reduce_by<KeyType, Type>(key_selector, [](const Type& value) { return value; }, reducer, policy);
+        }
+
+        template <typename KeyFunctor,
+                  typename Functor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, Type>>
+            aggregate_by(const KeyFunctor& key_selector, const Functor& reducer, const spill_policy& policy) const
+        {
+            return reduce_by<KeyType, Type>(key_selector, [](const Type& value) { return value; }, reducer, policy);
+        }
+
         template <typename Functor>
         bool all(const Functor& predicate) const
         {
@@ -1075,38 +5166,84 @@ namespace sb {
         template <typename ResultType>
         ResultType average(void) const
         {
-            if (empty()) {
-                throw enumerable_exception("get a value from an empty collection");
-            }
-
             ResultType total = 0;
             auto counter = 0;
 
-            for (auto it = begin(); it != end(); ++it, ++counter) {
+            for (auto it = begin(), last = end(); it != last; ++it, ++counter) {
                 total += *it;
             }
 
+            if (counter == 0) {
+                throw enumerable_exception("get a value from an empty collection");
+            }
+
             return total / counter;
         }
         
-        template <typename Iterator>
+        /* replay the elements produced by the first iteration instead of running the query again */
+        Self buffer(std::size_t limit = std::size_t(-1)) const
+        {
+            if (m_source || m_deferred) {
+                return *this;
+            }
+
+            auto state = make_counted<buffer_state<Type>>(begin(), end(), limit);
+
+            return plan_access::attach(Self(
+                make_buffer_iterator(state, 0),
+                make_buffer_iterator(state, std::size_t(-1))
+                ), stage_plan("buffer"));
+        }
+
+        template <typename Iterator, typename = typename std::enable_if<!is_range<Iterator>::value>::type>
         Self concat(const Iterator& right_begin, const Iterator& right_end) const
         {
-            return from (
-                make_concat_iterator(begin(), end(), right_begin),
-                make_concat_iterator(end(), end(), right_end)
-                );
+            return concat(Self(enumerable_iterator<Type>(right_begin), enumerable_iterator<Type>(right_end)));
+        }
+
+        template <typename Container>
+        Self concat(const Container& container) const
+        {
+            auto segments = make_counted<std::vector<Self>>();
+            append_segment(*segments, *this);
+            append_segment(*segments, container);
+            return concat_segments(segments);
+        }
+
+        template <typename Container,
+                  typename = typename std::enable_if<is_temporary_range<Container>::value && !std::is_same<Container, std::vector<Self>>::value>::type>
+        Self concat(Container&& container) const
+        {
+            return concat(from(std::move(container)));
+        }
+
+        template <typename First,
+                  typename Second,
+                  typename ...Rest,
+                  typename = typename std::enable_if<is_range<First>::value>::type>
+        Self concat(const First& first, const Second& second, const Rest&... rest) const
+        {
+            auto segments = make_counted<std::vector<Self>>();
+            append_segment(*segments, *this);
+            append_segments(*segments, first, second, rest...);
+            return concat_segments(segments);
         }
 
-        template <typename Container>
-        Self concat(const Container& container) const
+        Self concat(const std::vector<Self>& ranges) const
         {
-            return concat(std::begin(container), std::end(container));
+            auto segments = make_counted<std::vector<Self>>();
+            append_segment(*segments, *this);
+
+            for (auto& range : ranges) {
+                append_segment(*segments, range);
+            }
+
+            return concat_segments(segments);
         }
 
         Self concat(const std::initializer_list<Type>& container) const 
         {
-            return concat(std::begin(container), std::end(container));
+            return concat(from_values(container));
         }
         
         bool contains(const Type& value) const
@@ -1116,7 +5253,28 @@ namespace sb {
 
         int count(void) const
         {
-            return std::distance(begin(), end());
+            auto count = long_count();
+
+            if (count > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+                throw enumerable_exception("too many elements for count(), use long_count()");
+            }
+
+            return static_cast<int>(count);
+        }
+
+        std::size_t long_count(void) const
+        {
+            if (m_source && m_source->random_access()) {
+                return m_source->size();
+            }
+
+            std::size_t count = 0;
+
+            for (auto it = begin(); it != end(); ++it) {
+                count++;
+            }
+
+            return count;
         }
 
         template <typename Functor>
@@ -1125,13 +5283,51 @@ namespace sb {
             return static_cast<int>(std::count_if(begin(), end(), predicate));
         }
 
+        template <typename KeyFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, int>> count_by(const KeyFunctor& key_selector) const
+        {
+            return reduce_by<KeyType, int>(
+                key_selector,
+                [](const Type&) { return 1; },
+                [](int lhs, int rhs) { return lhs + rhs; });
+        }
+
+        template <typename KeyFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, int>> count_by(const KeyFunctor& key_selector, const parallel_policy& policy) const
+        {
+            return reduce_by<KeyType, int>(
+                key_selector,
+                [](const Type&) { return 1; },
+                [](int lhs, int rhs) { return lhs + rhs; },
+                policy);
+        }
+
+        template <typename KeyFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, int>> count_by(const KeyFunctor& key_selector, const spill_policy& policy) const
+        {
+            return reduce_by<KeyType, int>(
+                key_selector,
+                [](const Type&) { return 1; },
+                [](int lhs, int rhs) { return lhs + rhs; },
+                policy);
+        }
+
         Self default_if_empty(const Type& default_value) const
         {
-            if (empty()) {
-                return from_values({ default_value });
-            }
+            auto self = *this;
+            auto plan = stage_plan("default_if_empty");
 
-            return *this;
+            return plan_access::attach(defer<Type>([self, default_value]() -> Self {
+                stage_scope stage("default_if_empty");
+                if (self.empty()) {
+                    return from_values({ default_value });
+                }
+
+                return self;
+            }), plan);
         }
 
         Self default_if_empty(void) const
@@ -1141,16 +5337,29 @@ namespace sb {
 
         Self distinct(void) const 
         {
-            auto set = std::make_shared<std::set<Type>>();
+            return distinct(hashing(hasher<Type>(), std::equal_to<Type>()));
+        }
+
+        template <typename Hash, typename Equal>
+        Self distinct(const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("distinct");
+            auto resource = current_resource();
 
-            for (auto it = begin(); it != end(); ++it) {
-                set->insert(*it);
-            }
+            return plan_access::attach(defer<Type>([self, resource, policy]() -> Self {
+                stage_scope stage("distinct");
+                trace_span build("distinct", "build");
+                auto set = make_arena_shared<flat_set<Type, Hash, Equal>>(resource, policy.hash, policy.equal);
 
-            return from(
-                make_storage_iterator(set, set->begin()), 
-                make_storage_iterator(set, set->end())
-                );
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    set->insert(*it);
+                }
+
+                build.arg("rows", set->size());
+
+                return from_storage<Type>(set);
+            }), plan);
         }
 
         bool empty(void) const
@@ -1161,19 +5370,42 @@ namespace sb {
         template <typename Iterator>
         Self except_with(const Iterator& right_begin, const Iterator& right_end) const
         {
-            auto values = std::make_shared<std::vector<Type>>();
-            std::set<Type> set(right_begin, right_end);
+            return except_with(right_begin, right_end, hashing(hasher<Type>(), std::equal_to<Type>()));
+        }
 
-            for (auto it = begin(); it != end(); ++it) {
-                if (set.insert(*it).second) {
-                    values->push_back(*it);
+        template <typename Iterator, typename Hash, typename Equal>
+        Self except_with(const Iterator& right_begin, const Iterator& right_end, const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("except_with", make_plan("from"));
+
+            auto resource = current_resource();
+
+            return plan_access::attach(defer<Type>([self, resource, right_begin, right_end, policy]() -> Self {
+                stage_scope stage("except_with");
+                trace_span build("except_with", "build");
+                auto values = make_counted<std::vector<Type>>();
+                flat_set<Type, Hash, Equal> set(arena_allocator<Type>(resource), policy.hash, policy.equal);
+
+                for (auto it = right_begin; it != right_end; ++it) {
+                    set.insert(*it);
                 }
-            }
 
-            return from(
-                make_storage_iterator(values, values->begin()),
-                make_storage_iterator(values, values->end())
-                );
+                build.arg("rows", set.size());
+                build.end();
+
+                trace_span probe("except_with", "probe");
+
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    if (set.insert(*it).second) {
+                        values->push_back(*it);
+                    }
+                }
+
+                probe.arg("rows", values->size());
+
+                return from_storage<Type>(values);
+            }), plan);
         }
 
         template <typename Container>
@@ -1182,13 +5414,53 @@ namespace sb {
             return except_with(std::begin(container), std::end(container));
         }
 
+        template <typename Container, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        Self except_with(Container&& container) const
+        {
+            return except_with(from(std::move(container)));
+        }
+
         Self except_with(const std::initializer_list<Type>& container) const
         {
-            return except_with(std::begin(container), std::end(container));
+            return except_with(from_values(container));
+        }
+
+        template <typename Container, typename Hash, typename Equal>
+        Self except_with(const Container& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return except_with(std::begin(container), std::end(container), policy);
+        }
+
+        template <typename Container, typename Hash, typename Equal, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        Self except_with(Container&& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return except_with(from(std::move(container)), policy);
+        }
+
+        template <typename Hash, typename Equal>
+        Self except_with(const std::initializer_list<Type>& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return except_with(from_values(container), policy);
+        }
+
+        /* the operator tree of this query, one line per operator, each followed by the operators it reads from */
+        std::string explain(void) const
+        {
+            std::string plan;
+            explain_plan(input_plan(), 0, plan);
+            return plan;
         }
 
         Type element_at(int index)const
         {
+            if (m_source && m_source->random_access()) {
+                if (index < 0 || static_cast<std::size_t>(index) >= m_source->size()) {
+                    throw enumerable_exception("argument out of range");
+                }
+
+                return m_source->at(static_cast<std::size_t>(index));
+            }
+
             if (index >= 0) {
                 int counter = 0;
                 for (auto it = begin(); it != end(); it++) {
@@ -1209,16 +5481,12 @@ namespace sb {
         
         Type first(void) const
         {
-            if (empty()) {
-                throw enumerable_exception("get a value from an empty collection");
-            }
-
-            return *begin();
+            return try_first().value();
         }
         
         Type first_or_default(const Type& value) const
         {
-            return empty() ? value : *begin();
+            return try_first().value_or(value);
         }
 
         template <typename InnerIterator, 
@@ -1233,75 +5501,87 @@ namespace sb {
             const OuterKeyFunctor& outer_key_selector,
             const InnerKeyFunctor& inner_key_selector) const
         {
-            std::multimap<KeyType, OuterValueType> outer_map;
-            std::multimap<KeyType, InnerValueType> inner_map;
+            return full_join(right_begin, right_end, outer_key_selector, inner_key_selector, hashing(hasher<KeyType>(), std::equal_to<KeyType>()));
+        }
 
-            for (auto it = begin(); it != end(); ++it) {
-                auto value = *it;
-                auto key = outer_key_selector(value);
+        template <typename InnerIterator,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename InnerValueType = typename recover_type<typename std::iterator_traits<InnerIterator>::value_type>::type>
+        enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>>
+        full_join(const InnerIterator& right_begin,
+            const InnerIterator& right_end,
+            const OuterKeyFunctor& outer_key_selector,
+            const InnerKeyFunctor& inner_key_selector,
+            const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("full_join", make_plan("from"));
+            auto counted_outer_key_selector = counted(outer_key_selector, plan);
+            auto counted_inner_key_selector = counted(inner_key_selector, plan);
 
-                outer_map.insert(std::make_pair(key, value));
-            }
+            auto resource = current_resource();
 
-            for (auto it = right_begin; it != right_end; ++it) {
-                auto value = *it;
-                auto key = inner_key_selector(value);
+            return plan_access::attach(defer<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>>([self, resource, right_begin, right_end, counted_outer_key_selector, counted_inner_key_selector, policy]() -> enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>> {
+                stage_scope stage("full_join");
+                typedef std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>> Group;
 
-                inner_map.insert(std::make_pair(key, value));
-            }
+                typedef flat_map<KeyType, arena_vector<OuterValueType>, Hash, Equal> OuterTable;
+                typedef flat_map<KeyType, arena_vector<InnerValueType>, Hash, Equal> InnerTable;
 
-            auto map = std::make_shared<std::map<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>>();
-            auto outer_lower = outer_map.begin();
-            auto inner_lower = inner_map.begin();
+                OuterTable outer_table(arena_allocator<typename OuterTable::value_type>(resource), policy.hash, policy.equal);
+                InnerTable inner_table(arena_allocator<typename InnerTable::value_type>(resource), policy.hash, policy.equal);
+                key_store<KeyType> keys;
+                trace_span build("full_join", "build");
 
-            while (outer_lower != outer_map.end() && inner_lower != inner_map.end()) {
-                auto outer_key = outer_lower->first;
-                auto inner_key = inner_lower->first;
-                auto outer_upper = outer_map.upper_bound(outer_key);
-                auto inner_upper = inner_map.upper_bound(inner_key);
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    auto value = *it;
+                    const KeyType& key = counted_outer_key_selector(value);
 
-                if (outer_key < inner_key) {
-                    std::vector<OuterValueType> outers;
+                    outer_table.find_or_insert(key, [&key, &keys, &resource]() {
+                        return std::make_pair(keys.keep(key), arena_vector<OuterValueType>((arena_allocator<OuterValueType>(resource))));
+                    }).first->second.push_back(value);
+                }
 
-                    for (auto it = outer_lower; it != outer_upper; ++it) {
-                        outers.push_back(it->second);
-                    }
+                for (auto it = right_begin; it != right_end; ++it) {
+                    auto value = *it;
+                    const KeyType& key = counted_inner_key_selector(value);
 
-                    map->insert(std::make_pair(outer_key, std::make_pair(from_values(outers), enumerable<InnerValueType>())));
-                    outer_lower = outer_upper;
+                    inner_table.find_or_insert(key, [&key, &keys, &resource]() {
+                        return std::make_pair(keys.keep(key), arena_vector<InnerValueType>((arena_allocator<InnerValueType>(resource))));
+                    }).first->second.push_back(value);
+                }
 
-                } else if (outer_key > inner_key) {
-                    std::vector<InnerValueType> inners;
+                build.arg("outer", outer_table.size());
+                build.arg("inner", inner_table.size());
+                build.end();
 
-                    for (auto it = inner_lower; it != inner_upper; ++it) {
-                        inners.push_back(it->second);
-                    }
+                trace_span merge("full_join", "merge");
+                auto map = make_arena_shared<arena_vector<std::pair<KeyType, Group>>>(resource);
 
-                    map->insert(std::make_pair(outer_key, std::make_pair(enumerable<OuterValueType>(), from_values(inners))));
-                    inner_lower = inner_upper;
+                map->reserve(outer_table.size() + inner_table.size());
 
-                } else {
-                    std::vector<OuterValueType> outers;
-                    std::vector<InnerValueType> inners;
+                for (auto& outer : outer_table) {
+                    auto inner = inner_table.find(outer.first);
+                    auto inners = inner ? from_values(std::move(inner->second)) : enumerable<InnerValueType>();
 
-                    for (auto it = outer_lower; it != outer_upper; ++it) {
-                        outers.push_back(it->second);
-                    }
+                    map->push_back(std::make_pair(outer.first, Group(from_values(std::move(outer.second)), inners)));
+                }
 
-                    for (auto it = inner_lower; it != inner_upper; ++it) {
-                        inners.push_back(it->second);
+                for (auto& inner : inner_table) {
+                    if (!outer_table.find(inner.first)) {
+                        map->push_back(std::make_pair(inner.first, Group(enumerable<OuterValueType>(), from_values(std::move(inner.second)))));
                     }
-
-                    map->insert(std::make_pair(outer_key, std::make_pair(from_values(outers), from_values(inners))));
-                    outer_lower = outer_upper;
-                    inner_lower = inner_upper;
                 }
-            }
 
-            return enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>>(
-                make_storage_iterator(map, map->begin()),
-                make_storage_iterator(map, map->end())
-                );
+                merge.arg("rows", map->size());
+
+                return from_storage<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>>(keys.attach(map));
+            }), plan);
         }
 
         template <typename Container, 
@@ -1317,6 +5597,20 @@ namespace sb {
             return full_join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector);
         }
 
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto full_join(Container&& container,
+                       const OuterKeyFunctor& outer_key_selector,
+                       const InnerKeyFunctor& inner_key_selector) const ->
+            enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<typename recover_type<typename std::iterator_traits<decltype(std::begin(container))>::value_type>::type>>>>
+        {
+            return full_join(from(std::move(container)), outer_key_selector, inner_key_selector);
+        }
+
         template <typename InnerValueType,
                   typename OuterKeyFunctor,
                   typename InnerKeyFunctor,
@@ -1327,43 +5621,287 @@ namespace sb {
                        const InnerKeyFunctor& inner_key_selector) const ->
             enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>>
         {
-            return full_join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector);
+            return full_join(from_values(container), outer_key_selector, inner_key_selector);
+        }
+
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type>
+        auto full_join(const Container& container,
+                       const OuterKeyFunctor& outer_key_selector,
+                       const InnerKeyFunctor& inner_key_selector,
+                       const hash_policy<Hash, Equal>& policy) const ->
+            enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<typename recover_type<typename std::iterator_traits<decltype(std::begin(container))>::value_type>::type>>>>
+        {
+            return full_join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector, policy);
+        }
+
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto full_join(Container&& container,
+                       const OuterKeyFunctor& outer_key_selector,
+                       const InnerKeyFunctor& inner_key_selector,
+                       const hash_policy<Hash, Equal>& policy) const ->
+            enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<typename recover_type<typename std::iterator_traits<decltype(std::begin(container))>::value_type>::type>>>>
+        {
+            return full_join(from(std::move(container)), outer_key_selector, inner_key_selector, policy);
+        }
+
+        template <typename InnerValueType,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type>
+        auto full_join(const std::initializer_list<InnerValueType>& container,
+                       const OuterKeyFunctor& outer_key_selector,
+                       const InnerKeyFunctor& inner_key_selector,
+                       const hash_policy<Hash, Equal>& policy) const ->
+            enumerable<std::pair<KeyType, std::pair<enumerable<OuterValueType>, enumerable<InnerValueType>>>>
+        {
+            return full_join(from_values(container), outer_key_selector, inner_key_selector, policy);
+        }
+
+        template <typename KeyFunctor,
+                  typename ResultType,
+                  typename Functor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ResultType>>
+            group_aggregate(const KeyFunctor& key_selector, const ResultType& seed, const Functor& reducer) const
+        {
+            return group_aggregate(key_selector, seed, reducer, hashing(hasher<KeyType>(), std::equal_to<KeyType>()));
+        }
+
+        template <typename KeyFunctor,
+                  typename ResultType,
+                  typename Functor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ResultType>>
+            group_aggregate(const KeyFunctor& key_selector,
+                            const ResultType& seed,
+                            const Functor& reducer,
+                            const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("group_aggregate");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_reducer = counted(reducer, plan);
+
+            auto resource = current_resource();
+
+            return plan_access::attach(defer<std::pair<KeyType, ResultType>>([self, resource, counted_key_selector, seed, counted_reducer, policy]() -> enumerable<std::pair<KeyType, ResultType>> {
+                stage_scope stage("group_aggregate");
+                trace_span build("group_aggregate", "build");
+                auto table = make_arena_shared<flat_map<KeyType, ResultType, Hash, Equal>>(resource, policy.hash, policy.equal);
+                key_store<KeyType> keys;
+
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    auto value = *it;
+                    const KeyType& key = counted_key_selector(value);
+                    auto hit = table->find_or_insert(key, [&key, &keys, &seed]() { return std::make_pair(keys.keep(key), seed); }).first;
+
+                    hit->second = counted_reducer(hit->second, value);
+                }
+
+                build.arg("groups", table->size());
+
+                return from_storage<std::pair<KeyType, ResultType>>(keys.attach(table));
+            }), plan);
         }
 
-        template <typename KeyFunctor, 
-                  typename ValueFunctor, 
-                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type, 
+        template <typename KeyFunctor,
+                  typename ResultType,
+                  typename Functor,
+                  typename Combiner,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ResultType>>
+            group_aggregate(const KeyFunctor& key_selector,
+                            const ResultType& seed,
+                            const Functor& reducer,
+                            const Combiner& combiner,
+                            const parallel_policy& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("group_aggregate");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_reducer = counted(reducer, plan);
+            auto counted_combiner = counted(combiner, plan);
+
+            return plan_access::attach(defer<std::pair<KeyType, ResultType>>([self, counted_key_selector, seed, counted_reducer, counted_combiner, policy]() -> enumerable<std::pair<KeyType, ResultType>> {
+                stage_scope stage("group_aggregate");
+                return from_storage<std::pair<KeyType, ResultType>>(self.template parallel_reduce_by<KeyType, ResultType>(
+                    counted_key_selector,
+                    [&seed, &counted_reducer](const Type& value) { return counted_reducer(seed, value); },
+                    [&counted_reducer](ResultType& state, const Type& value) { state = counted_reducer(state, value); },
+                    [&counted_combiner](ResultType& state, const ResultType& rhs) { state = counted_combiner(state, rhs); },
+                    policy));
+            }), plan);
+        }
+
+        template <typename KeyFunctor,
+                  typename ResultType,
+                  typename Functor,
+                  typename Combiner,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ResultType>>
+            group_aggregate(const KeyFunctor& key_selector,
+                            const ResultType& seed,
+                            const Functor& reducer,
+                            const Combiner& combiner,
+                            const spill_policy& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("group_aggregate");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_reducer = counted(reducer, plan);
+            auto counted_combiner = counted(combiner, plan);
+
+            return plan_access::attach(defer<std::pair<KeyType, ResultType>>([self, counted_key_selector, seed, counted_reducer, counted_combiner, policy]() -> enumerable<std::pair<KeyType, ResultType>> {
+                stage_scope stage("group_aggregate");
+                return self.template spill_reduce_by<KeyType, ResultType, std::pair<KeyType, ResultType>>(
+                    counted_key_selector,
+                    [&seed, &counted_reducer](const Type& value) { return counted_reducer(seed, value); },
+                    [&counted_reducer](ResultType& state, const Type& value) { state = counted_reducer(state, value); },
+                    [counted_combiner](ResultType& state, const ResultType& rhs) { state = counted_combiner(state, rhs); },
+                    [](const KeyType& key, ResultType& state) { return std::make_pair(key, state); },
+                    0,
+                    policy);
+            }), plan);
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
                   typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
-        enumerable<std::pair<KeyType, enumerable<ValueType>>> 
+        enumerable<std::pair<KeyType, enumerable<ValueType>>>
             group_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector) const
         {
-            std::map<KeyType, std::shared_ptr<std::vector<ValueType>>> group;
+            return group_by(key_selector, value_selector, hashing(hasher<KeyType>(), std::equal_to<KeyType>()));
+        }
 
-            for (auto it = begin(); it != end(); ++it) {
-                auto value = value_selector(*it);
-                auto key = key_selector(*it);
-                auto hit = group.find(key);
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, enumerable<ValueType>>>
+            group_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("group_by");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_value_selector = counted(value_selector, plan);
 
-                if (hit == group.end()) {
-                    auto values = std::make_shared<std::vector<ValueType>>();
-                    values->push_back(value);
-                    group.insert(std::make_pair(key, values));
+            auto resource = current_resource();
 
-                } else {
-                    hit->second->push_back(value);
+            return plan_access::attach(defer<std::pair<KeyType, enumerable<ValueType>>>([self, resource, counted_key_selector, counted_value_selector, policy]() -> enumerable<std::pair<KeyType, enumerable<ValueType>>> {
+                stage_scope stage("group_by");
+                typedef flat_map<KeyType, std::shared_ptr<arena_vector<ValueType>>, Hash, Equal> Table;
+
+                trace_span build("group_by", "build");
+                Table group(arena_allocator<typename Table::value_type>(resource), policy.hash, policy.equal);
+                key_store<KeyType> keys;
+
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    auto element = *it;
+                    auto value = counted_value_selector(element);
+                    const KeyType& key = counted_key_selector(element);
+
+                    group.find_or_insert(key, [&key, &keys, &resource]() {
+                        return std::make_pair(keys.keep(key), make_arena_shared<arena_vector<ValueType>>(resource));
+                    }).first->second->push_back(value);
                 }
-            }
 
-            auto result = std::make_shared<std::map<KeyType, enumerable<ValueType>>>();
+                build.arg("groups", group.size());
+                build.end();
 
-            for (auto pair : group) {
-                result->insert(std::make_pair(pair.first, from_values(pair.second)));
-            }
+                auto result = make_arena_shared<arena_vector<std::pair<KeyType, enumerable<ValueType>>>>(resource);
 
-            return enumerable<std::pair<KeyType, enumerable<ValueType>>>(
-                make_storage_iterator(result, result->begin()),
-                make_storage_iterator(result, result->end())
-                );
+                result->reserve(group.size());
+
+                for (auto& pair : group) {
+                    result->push_back(std::make_pair(pair.first, from_values(pair.second)));
+                }
+
+                return from_storage<std::pair<KeyType, enumerable<ValueType>>>(keys.attach(result));
+            }), plan);
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, enumerable<ValueType>>>
+            group_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const parallel_policy& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("group_by");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_value_selector = counted(value_selector, plan);
+
+            return plan_access::attach(defer<std::pair<KeyType, enumerable<ValueType>>>([self, counted_key_selector, counted_value_selector, policy]() -> enumerable<std::pair<KeyType, enumerable<ValueType>>> {
+                stage_scope stage("group_by");
+                auto groups = self.template parallel_reduce_by<KeyType, std::vector<ValueType>>(
+                    counted_key_selector,
+                    [&counted_value_selector](const Type& value) { return std::vector<ValueType>(1, counted_value_selector(value)); },
+                    [&counted_value_selector](std::vector<ValueType>& values, const Type& value) { values.push_back(counted_value_selector(value)); },
+                    [](std::vector<ValueType>& values, const std::vector<ValueType>& rhs) { values.insert(values.end(), rhs.begin(), rhs.end()); },
+                    policy);
+                auto result = make_counted<std::vector<std::pair<KeyType, enumerable<ValueType>>>>();
+
+                result->reserve(groups->size());
+
+                for (auto& pair : *groups) {
+                    auto values = make_counted<std::vector<ValueType>>();
+                    values->swap(pair.second);
+                    result->push_back(std::make_pair(pair.first, from_storage<ValueType>(values)));
+                }
+
+                return from_storage<std::pair<KeyType, enumerable<ValueType>>>(result);
+            }), plan);
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, enumerable<ValueType>>>
+            group_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const spill_policy& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("group_by");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_value_selector = counted(value_selector, plan);
+
+            return plan_access::attach(defer<std::pair<KeyType, enumerable<ValueType>>>([self, counted_key_selector, counted_value_selector, policy]() -> enumerable<std::pair<KeyType, enumerable<ValueType>>> {
+                stage_scope stage("group_by");
+                return self.template spill_reduce_by<KeyType, std::vector<ValueType>, std::pair<KeyType, enumerable<ValueType>>>(
+                    counted_key_selector,
+                    [&counted_value_selector](const Type& value) { return std::vector<ValueType>(1, counted_value_selector(value)); },
+                    [&counted_value_selector](std::vector<ValueType>& values, const Type& value) { values.push_back(counted_value_selector(value)); },
+                    [](std::vector<ValueType>& values, const std::vector<ValueType>& rhs) { values.insert(values.end(), rhs.begin(), rhs.end()); },
+                    [](const KeyType& key, std::vector<ValueType>& values) {
+                        auto group = make_counted<std::vector<ValueType>>();
+                        group->swap(values);
+                        return std::make_pair(key, from_values(group));
+                    },
+                    sizeof(ValueType),
+                    policy);
+            }), plan);
         }
 
         template <typename Functor>
@@ -1373,6 +5911,27 @@ namespace sb {
             return group_by(key_selector, [](const Type& value) { return value;});
         }
 
+        template <typename Functor>
+        enumerable<std::pair<typename functor_retriver<decltype(&Functor::operator())>::type, enumerable<Type>>>
+            group_by(const Functor& key_selector, const parallel_policy& policy) const
+        {
+            return group_by(key_selector, [](const Type& value) { return value;}, policy);
+        }
+
+        template <typename Functor>
+        enumerable<std::pair<typename functor_retriver<decltype(&Functor::operator())>::type, enumerable<Type>>>
+            group_by(const Functor& key_selector, const spill_policy& policy) const
+        {
+            return group_by(key_selector, [](const Type& value) { return value;}, policy);
+        }
+
+        template <typename Functor, typename Hash, typename Equal>
+        enumerable<std::pair<typename functor_retriver<decltype(&Functor::operator())>::type, enumerable<Type>>>
+            group_by(const Functor& key_selector, const hash_policy<Hash, Equal>& policy) const
+        {
+            return group_by(key_selector, [](const Type& value) { return value;}, policy);
+        }
+
         template <typename InnerIterator,
                   typename OuterKeyFunctor, 
                   typename InnerKeyFunctor,
@@ -1385,60 +5944,180 @@ namespace sb {
                        const OuterKeyFunctor& outer_key_selector, 
                        const InnerKeyFunctor& inner_key_selector) const
         {
-            auto table = full_join(inner_begin, inner_end, outer_key_selector, inner_key_selector);
-            auto map = std::make_shared<std::multimap<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>();
-
-            for (auto pair : table) {
-                for (auto outer_value : pair.second.first) {
-                    map->insert(std::make_pair(pair.first, std::make_pair(outer_value, from_values(pair.second.second))));
-                }
-            }
-            
-            return enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>(
-                make_storage_iterator(map, map->begin()),
-                make_storage_iterator(map, map->end())
-                );
+            return group_join(inner_begin, inner_end, outer_key_selector, inner_key_selector, hashing(hasher<KeyType>(), std::equal_to<KeyType>()));
+        }
+
+        template <typename InnerIterator,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename InnerValueType = typename recover_type<typename std::iterator_traits<InnerIterator>::value_type>::type>
+        enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>
+            group_join(const InnerIterator& inner_begin,
+                       const InnerIterator& inner_end,
+                       const OuterKeyFunctor& outer_key_selector,
+                       const InnerKeyFunctor& inner_key_selector,
+                       const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("group_join", make_plan("from"));
+            auto counted_outer_key_selector = counted(outer_key_selector, plan);
+            auto counted_inner_key_selector = counted(inner_key_selector, plan);
+
+            auto resource = current_resource();
+
+            return plan_access::attach(defer<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>([self, resource, inner_begin, inner_end, counted_outer_key_selector, counted_inner_key_selector, policy]() -> enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>> {
+                stage_scope stage("group_join");
+                resource_scope scope(resource);
+                auto table = self.full_join(inner_begin, inner_end, counted_outer_key_selector, counted_inner_key_selector, policy);
+                auto map = make_arena_shared<arena_vector<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>>(resource);
+                trace_span probe("group_join", "probe");
+
+                for (auto pair : table) {
+                    for (auto outer_value : pair.second.first) {
+                        map->push_back(std::make_pair(pair.first, std::make_pair(outer_value, pair.second.second)));
+                    }
+                }
+
+                probe.arg("rows", map->size());
+
+                return from_storage<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>(key_store<KeyType>::attach(map, table));
+            }), plan);
+        }
+
+        template <typename Container,
+            typename OuterKeyFunctor,
+            typename InnerKeyFunctor,
+            typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+            typename OuterValueType = Type>
+        auto group_join(const Container& container,
+                        const OuterKeyFunctor& outer_key_selector,
+                        const InnerKeyFunctor& inner_key_selector) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<typename recover_type<decltype(*std::begin(container))>::type>>>>
+        {
+            return group_join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector);
+        }
+
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto group_join(Container&& container,
+                        const OuterKeyFunctor& outer_key_selector,
+                        const InnerKeyFunctor& inner_key_selector) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<typename recover_type<decltype(*std::begin(container))>::type>>>>
+        {
+            return group_join(from(std::move(container)), outer_key_selector, inner_key_selector);
+        }
+     
+        template <typename InnerValueType,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type>
+        auto group_join(const std::initializer_list<InnerValueType>& container,
+                        const OuterKeyFunctor& outer_key_selector,
+                        const InnerKeyFunctor& inner_key_selector) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>
+        {
+            return group_join(from_values(container), outer_key_selector, inner_key_selector);
+        }
+
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type>
+        auto group_join(const Container& container,
+                        const OuterKeyFunctor& outer_key_selector,
+                        const InnerKeyFunctor& inner_key_selector,
+                        const hash_policy<Hash, Equal>& policy) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<typename recover_type<decltype(*std::begin(container))>::type>>>>
+        {
+            return group_join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector, policy);
         }
 
         template <typename Container,
-            typename OuterKeyFunctor,
-            typename InnerKeyFunctor,
-            typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
-            typename OuterValueType = Type>
-        auto group_join(const Container& container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto group_join(Container&& container,
                         const OuterKeyFunctor& outer_key_selector,
-                        const InnerKeyFunctor& inner_key_selector) const ->
+                        const InnerKeyFunctor& inner_key_selector,
+                        const hash_policy<Hash, Equal>& policy) const ->
             enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<typename recover_type<decltype(*std::begin(container))>::type>>>>
         {
-            return group_join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector);
+            return group_join(from(std::move(container)), outer_key_selector, inner_key_selector, policy);
         }
-     
+
         template <typename InnerValueType,
                   typename OuterKeyFunctor,
                   typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
                   typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
                   typename OuterValueType = Type>
         auto group_join(const std::initializer_list<InnerValueType>& container,
                         const OuterKeyFunctor& outer_key_selector,
-                        const InnerKeyFunctor& inner_key_selector) const ->
+                        const InnerKeyFunctor& inner_key_selector,
+                        const hash_policy<Hash, Equal>& policy) const ->
             enumerable<std::pair<KeyType, std::pair<OuterValueType, enumerable<InnerValueType>>>>
         {
-            return group_join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector);
+            return group_join(from_values(container), outer_key_selector, inner_key_selector, policy);
         }
 
         template <typename Iterator>
         Self intersect_with(const Iterator& right_begin, const Iterator& right_end) const
         {
-            std::set<Type> left, right(right_begin, right_end);
-            auto values = std::make_shared<std::vector<Type>>();
-            
-            for (auto it = begin(); it != end(); ++it) {
-                if (left.insert(*it).second && !right.insert(*it).second) {
-                    values->push_back(*it);
+            return intersect_with(right_begin, right_end, hashing(hasher<Type>(), std::equal_to<Type>()));
+        }
+
+        template <typename Iterator, typename Hash, typename Equal>
+        Self intersect_with(const Iterator& right_begin, const Iterator& right_end, const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("intersect_with", make_plan("from"));
+
+            auto resource = current_resource();
+
+            return plan_access::attach(defer<Type>([self, resource, right_begin, right_end, policy]() -> Self {
+                stage_scope stage("intersect_with");
+                flat_set<Type, Hash, Equal> left(arena_allocator<Type>(resource), policy.hash, policy.equal);
+                flat_set<Type, Hash, Equal> right(arena_allocator<Type>(resource), policy.hash, policy.equal);
+                auto values = make_counted<std::vector<Type>>();
+
+                trace_span build("intersect_with", "build");
+
+                for (auto it = right_begin; it != right_end; ++it) {
+                    right.insert(*it);
                 }
-            }
 
-            return from_values(values);
+                build.arg("rows", right.size());
+                build.end();
+
+                trace_span probe("intersect_with", "probe");
+
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    if (left.insert(*it).second && !right.insert(*it).second) {
+                        values->push_back(*it);
+                    }
+                }
+
+                probe.arg("rows", values->size());
+
+                return from_storage<Type>(values);
+            }), plan);
         }
 
         template <typename Container>
@@ -1447,9 +6126,33 @@ namespace sb {
             return intersect_with(std::begin(container), std::end(container));
         }
 
+        template <typename Container, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        Self intersect_with(Container&& container) const
+        {
+            return intersect_with(from(std::move(container)));
+        }
+
         Self intersect_with(const std::initializer_list<Type>& container) const
         {
-            return intersect_with(std::begin(container), std::end(container));
+            return intersect_with(from_values(container));
+        }
+
+        template <typename Container, typename Hash, typename Equal>
+        Self intersect_with(const Container& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return intersect_with(std::begin(container), std::end(container), policy);
+        }
+
+        template <typename Container, typename Hash, typename Equal, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        Self intersect_with(Container&& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return intersect_with(from(std::move(container)), policy);
+        }
+
+        template <typename Hash, typename Equal>
+        Self intersect_with(const std::initializer_list<Type>& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return intersect_with(from_values(container), policy);
         }
 
         template <typename InnerIterator,
@@ -1464,19 +6167,48 @@ namespace sb {
                  const OuterKeyFunctor& outer_key_selector,
                  const InnerKeyFunctor& inner_key_selector) const
         {
-            auto table = group_join(inner_begin, inner_end, outer_key_selector, inner_key_selector);
-            auto map = std::make_shared<std::multimap<KeyType, std::pair<OuterValueType, InnerValueType>>>();
+            return join(inner_begin, inner_end, outer_key_selector, inner_key_selector, hashing(hasher<KeyType>(), std::equal_to<KeyType>()));
+        }
 
-            for (auto pair : table) {
-                for (auto value : pair.second.second) {
-                    map->insert(std::make_pair(pair.first, std::make_pair(pair.second.first, value)));
+        template <typename InnerIterator,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename InnerValueType = typename recover_type<typename std::iterator_traits<InnerIterator>::value_type>::type>
+        enumerable<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>>
+            join(const InnerIterator& inner_begin,
+                 const InnerIterator& inner_end,
+                 const OuterKeyFunctor& outer_key_selector,
+                 const InnerKeyFunctor& inner_key_selector,
+                 const hash_policy<Hash, Equal>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("join", make_plan("from"));
+            auto counted_outer_key_selector = counted(outer_key_selector, plan);
+            auto counted_inner_key_selector = counted(inner_key_selector, plan);
+
+            auto resource = current_resource();
+
+            return plan_access::attach(defer<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>>([self, resource, inner_begin, inner_end, counted_outer_key_selector, counted_inner_key_selector, policy]() -> enumerable<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>> {
+                stage_scope stage("join");
+                resource_scope scope(resource);
+                auto table = self.group_join(inner_begin, inner_end, counted_outer_key_selector, counted_inner_key_selector, policy);
+                auto map = make_arena_shared<arena_vector<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>>>(resource);
+                trace_span probe("join", "probe");
+
+                for (auto pair : table) {
+                    for (auto value : pair.second.second) {
+                        map->push_back(std::make_pair(pair.first, std::make_pair(pair.second.first, value)));
+                    }
                 }
-            }
 
-            return enumerable<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>>(
-                make_storage_iterator(map, map->begin()),
-                make_storage_iterator(map, map->end())
-                );
+                probe.arg("rows", map->size());
+
+                return from_storage<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>>(key_store<KeyType>::attach(map, table));
+            }), plan);
         }
 
         template <typename Container,
@@ -1492,6 +6224,20 @@ namespace sb {
             return join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector);
         }
 
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto join(Container&& container,
+                  const OuterKeyFunctor& outer_key_selector,
+                  const InnerKeyFunctor& inner_key_selector) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, typename recover_type<decltype(*std::begin(container))>::type>>>
+        {
+            return join(from(std::move(container)), outer_key_selector, inner_key_selector);
+        }
+
         template <typename InnerValueType,
                   typename OuterKeyFunctor,
                   typename InnerKeyFunctor,
@@ -1502,123 +6248,462 @@ namespace sb {
                   const InnerKeyFunctor& inner_key_selector) const ->
             enumerable<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>>
         {
-            return join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector);
+            return join(from_values(container), outer_key_selector, inner_key_selector);
         }
 
-        Type last(void) const 
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type>
+        auto join(const Container& container,
+                  const OuterKeyFunctor& outer_key_selector,
+                  const InnerKeyFunctor& inner_key_selector,
+                  const hash_policy<Hash, Equal>& policy) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, typename recover_type<decltype(*std::begin(container))>::type>>>
         {
-            if (empty()) {
-                throw enumerable_exception("get a value from an empty collection");
-            }
+            return join(std::begin(container), std::end(container), outer_key_selector, inner_key_selector, policy);
+        }
 
-            auto it = begin();
-            auto result = *it;
+        template <typename Container,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type,
+                  typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto join(Container&& container,
+                  const OuterKeyFunctor& outer_key_selector,
+                  const InnerKeyFunctor& inner_key_selector,
+                  const hash_policy<Hash, Equal>& policy) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, typename recover_type<decltype(*std::begin(container))>::type>>>
+        {
+            return join(from(std::move(container)), outer_key_selector, inner_key_selector, policy);
+        }
 
-            while (++it != end()) {
-                result = *it;
-            }
+        template <typename InnerValueType,
+                  typename OuterKeyFunctor,
+                  typename InnerKeyFunctor,
+                  typename Hash,
+                  typename Equal,
+                  typename KeyType = typename functor_retriver<decltype(&OuterKeyFunctor::operator())>::type,
+                  typename OuterValueType = Type>
+        auto join(const std::initializer_list<InnerValueType>& container,
+                  const OuterKeyFunctor& outer_key_selector,
+                  const InnerKeyFunctor& inner_key_selector,
+                  const hash_policy<Hash, Equal>& policy) const ->
+            enumerable<std::pair<KeyType, std::pair<OuterValueType, InnerValueType>>>
+        {
+            return join(from_values(container), outer_key_selector, inner_key_selector, policy);
+        }
 
-            return result;
+        Type last(void) const 
+        {
+            return try_last().value();
         }
 
         Type last_or_default(const Type& value) const
         {
-            auto result = value;
+            return try_last().value_or(value);
+        }
 
-            for (auto it = begin(); it != end(); ++it) {
-                result = *it;
-            }
+        /* pair every element with selector(element), computed once per element and shared by later stages */
+        template <typename Functor,
+                  typename ValueType = typename functor_retriver<decltype(&Functor::operator())>::type>
+        enumerable<let_value<Type, ValueType>> let(const Functor& selector) const
+        {
+            auto plan = stage_plan("let");
+            auto counted_selector = counted(selector, plan);
 
-            return result;
+            return plan_access::attach(enumerable<let_value<Type, ValueType>>(
+                make_let_iterator<ValueType>(begin(), counted_selector),
+                make_let_iterator<ValueType>(end(), counted_selector)
+                ), plan);
         }
 
         Type max(void) const 
         {
-            if (empty()) {
-                throw enumerable_exception("get a value from an empty collection");
-            }
-           
-            return *std::max_element(begin(), end());
+            return try_max().value();
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>> max_by_key(const KeyFunctor& key_selector, const ValueFunctor& value_selector) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return lhs < rhs ? rhs : lhs; });
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            max_by_key(const KeyFunctor& key_selector) const
+        {
+            return max_by_key(key_selector, [](const Type& value) { return value; });
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>>
+            max_by_key(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const parallel_policy& policy) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return lhs < rhs ? rhs : lhs; },
+                policy);
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>>
+            max_by_key(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const spill_policy& policy) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return lhs < rhs ? rhs : lhs; },
+                policy);
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            max_by_key(const KeyFunctor& key_selector, const parallel_policy& policy) const
+        {
+            return max_by_key(key_selector, [](const Type& value) { return value; }, policy);
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            max_by_key(const KeyFunctor& key_selector, const spill_policy& policy) const
+        {
+            return max_by_key(key_selector, [](const Type& value) { return value; }, policy);
         }
 
         Type min(void) const 
         {
-            if (empty()) {
-                throw enumerable_exception("get a value from an empty collection");
-            }
-           
-            return *std::min_element(begin(), end());
+            return try_min().value();
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>> min_by_key(const KeyFunctor& key_selector, const ValueFunctor& value_selector) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return rhs < lhs ? rhs : lhs; });
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            min_by_key(const KeyFunctor& key_selector) const
+        {
+            return min_by_key(key_selector, [](const Type& value) { return value; });
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>>
+            min_by_key(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const parallel_policy& policy) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return rhs < lhs ? rhs : lhs; },
+                policy);
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>>
+            min_by_key(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const spill_policy& policy) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return rhs < lhs ? rhs : lhs; },
+                policy);
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            min_by_key(const KeyFunctor& key_selector, const parallel_policy& policy) const
+        {
+            return min_by_key(key_selector, [](const Type& value) { return value; }, policy);
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            min_by_key(const KeyFunctor& key_selector, const spill_policy& policy) const
+        {
+            return min_by_key(key_selector, [](const Type& value) { return value; }, policy);
         }
 
         template <typename Functor>
         enumerable<Type> order_by(const Functor& selector) const 
         {
-            auto values = std::make_shared<std::vector<Type>>();
+            auto self = *this;
+            auto plan = stage_plan("order_by");
+            auto counted_selector = counted(selector, plan);
+
+            return plan_access::attach(defer<Type>([self, counted_selector]() -> Self {
+                stage_scope stage("order_by");
+                auto values = make_counted<std::vector<Type>>();
+                trace_span build("order_by", "build");
             
-            for (auto it = begin(); it != end(); ++it) {
-                values->push_back(*it);
-                std::push_heap(values->begin(), values->end(), [&selector](const Type& lhs, const Type& rhs){return selector(lhs) < selector(rhs);});
-            }
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    values->push_back(*it);
+                    std::push_heap(values->begin(), values->end(), [&counted_selector](const Type& lhs, const Type& rhs){return counted_selector(lhs) < counted_selector(rhs);});
+                }
 
-            std::sort_heap(values->begin(), values->end(), [&selector](const Type& lhs, const Type& rhs){return selector(lhs) < selector(rhs);});
+                build.arg("rows", values->size());
+                build.end();
 
-            return enumerable<Type>(
-                make_storage_iterator(values, values->begin()),
-                make_storage_iterator(values, values->end())
-                );
+                trace_span sort("order_by", "sort");
+                std::sort_heap(values->begin(), values->end(), [&counted_selector](const Type& lhs, const Type& rhs){return counted_selector(lhs) < counted_selector(rhs);});
+
+                return from_storage<Type>(values);
+            }), plan);
         }
 
         template <typename Functor>
         Self order_by_descending(const Functor& selector) const
         {
-            auto values = std::make_shared<std::vector<Type>>();
+            auto self = *this;
+            auto plan = stage_plan("order_by_descending");
+            auto counted_selector = counted(selector, plan);
 
-            for (auto it = begin(); it != end(); ++it) {
-                values->push_back(*it);
-                std::push_heap(values->begin(), values->end(), [&selector](const Type& lhs, const Type& rhs){return selector(lhs) > selector(rhs); });
-            }
+            return plan_access::attach(defer<Type>([self, counted_selector]() -> Self {
+                stage_scope stage("order_by_descending");
+                auto values = make_counted<std::vector<Type>>();
+                trace_span build("order_by_descending", "build");
 
-            std::sort_heap(values->begin(), values->end(), [&selector](const Type& lhs, const Type& rhs){return selector(lhs) > selector(rhs); });
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    values->push_back(*it);
+                    std::push_heap(values->begin(), values->end(), [&counted_selector](const Type& lhs, const Type& rhs){return counted_selector(lhs) > counted_selector(rhs); });
+                }
 
-            return from (
-                make_storage_iterator(values, values->begin()),
-                make_storage_iterator(values, values->end())
-                );
+                build.arg("rows", values->size());
+                build.end();
+
+                trace_span sort("order_by_descending", "sort");
+                std::sort_heap(values->begin(), values->end(), [&counted_selector](const Type& lhs, const Type& rhs){return counted_selector(lhs) > counted_selector(rhs); });
+
+                return from_storage<Type>(values);
+            }), plan);
         }
 
-        Self reverse(void) const 
+        /* run the query to the end, recording elements, functor calls and wall time of each operator */
+        query_profile profile(void) const
         {
-            auto values = std::make_shared<std::list<Type>>();
+            return run_profile(nullptr);
+        }
 
-            for (auto it = begin(); it != end(); ++it) {
-                values->push_front(*it);
+        /* the same, also attributing hardware counters to each operator where the platform allows it */
+        query_profile profile(const hardware_policy&) const
+        {
+            hardware_counters counters;
+            query_profile profile = run_profile(&counters);
+
+            for (int i = 0; i < hardware_counters::events; ++i) {
+                profile.counted[i] = counters.available(i);
             }
 
-            return from(
-                make_storage_iterator(values, values->begin()),
-                make_storage_iterator(values, values->end())
-                );
+            profile.counter_status = counters.status();
+            return profile;
+        }
+
+        Self reverse(void) const 
+        {
+            return plan_access::attach(reversed(), stage_plan("reverse"));
+        }
+
+        /* k elements chosen uniformly in one pass and O(k) memory (reservoir, Li's algorithm L), in no particular order */
+        Self sample(std::size_t count) const
+        {
+            return sample(count, unseeded());
+        }
+
+        template <typename Engine>
+        Self sample(std::size_t count, const random_policy<Engine>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("sample(" + std::to_string(count) + ")");
+
+            return plan_access::attach(defer<Type>([self, count, policy]() -> Self {
+                stage_scope stage("sample");
+                trace_span build("sample", "build");
+                auto values = make_counted<std::vector<Type>>();
+                Engine engine;
+                uniform_real<double> unit(0, 1);
+                auto it = self.begin();
+
+                random_engine_traits<Engine>::seed(engine, policy.seed);
+
+                for (; values->size() < count && it != self.end(); ++it) {
+                    values->push_back(*it);
+                }
+
+                if (count == 0 || it == self.end()) {
+                    return from_storage<Type>(values);
+                }
+
+                /* every later element replaces a random slot with probability count / seen; the gaps are geometric in the running weight */
+                double weight = std::exp(std::log(1 - unit(engine)) / count);
+
+                for (;;) {
+                    double gap = std::floor(std::log(1 - unit(engine)) / std::log1p(-weight));
+
+                    for (; gap > 0 && it != self.end(); --gap) {
+                        ++it;
+                    }
+
+                    if (it == self.end()) {
+                        break;
+                    }
+
+                    (*values)[uniform_int<std::size_t>(0, count - 1)(engine)] = *it;
+                    weight *= std::exp(std::log(1 - unit(engine)) / count);
+                    ++it;
+                }
+
+                build.arg("rows", values->size());
+                return from_storage<Type>(values);
+            }), plan);
+        }
+
+        /* each element kept independently with probability fraction, lazily */
+        Self sample_fraction(double fraction) const
+        {
+            return sample_fraction(fraction, unseeded());
+        }
+
+        template <typename Engine>
+        Self sample_fraction(double fraction, const random_policy<Engine>& policy) const
+        {
+            Engine engine;
+            random_engine_traits<Engine>::seed(engine, policy.seed);
+
+            return plan_access::attach(Self(
+                make_sample_iterator(begin(), end(), fraction, engine),
+                make_sample_iterator(end(), end(), fraction, engine)
+                ), stage_plan("sample_fraction"));
+        }
+
+        /*
+         * k elements without replacement, each chosen with probability proportional to
+         * weight_selector (Efraimidis and Spirakis, A-Res); elements weighing zero or less are
+         * never chosen. one pass, O(k) memory, in no particular order
+         */
+        template <typename Functor>
+        Self sample_weighted(std::size_t count, const Functor& weight_selector) const
+        {
+            return sample_weighted(count, weight_selector, unseeded());
+        }
+
+        template <typename Functor, typename Engine>
+        Self sample_weighted(std::size_t count, const Functor& weight_selector, const random_policy<Engine>& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("sample_weighted(" + std::to_string(count) + ")");
+            auto counted_weight_selector = counted(weight_selector, plan);
+
+            return plan_access::attach(defer<Type>([self, count, counted_weight_selector, policy]() -> Self {
+                stage_scope stage("sample_weighted");
+                trace_span build("sample_weighted", "build");
+                typedef std::pair<double, Type> Keyed;
+
+                auto smallest = [](const Keyed& lhs, const Keyed& rhs) { return lhs.first > rhs.first; };
+                std::vector<Keyed> heap;
+                Engine engine;
+                uniform_real<double> unit(0, 1);
+
+                random_engine_traits<Engine>::seed(engine, policy.seed);
+
+                for (auto it = self.begin(); count > 0 && it != self.end(); ++it) {
+                    auto value = *it;
+                    double weight = static_cast<double>(counted_weight_selector(value));
+
+                    if (!(weight > 0)) {
+                        continue;
+                    }
+
+                    /* the key u ^ (1 / weight), compared through its logarithm */
+                    double key = std::log(1 - unit(engine)) / weight;
+
+                    if (heap.size() < count) {
+                        heap.push_back(Keyed(key, value));
+                        std::push_heap(heap.begin(), heap.end(), smallest);
+
+                    } else if (key > heap.front().first) {
+                        std::pop_heap(heap.begin(), heap.end(), smallest);
+                        heap.back() = Keyed(key, value);
+                        std::push_heap(heap.begin(), heap.end(), smallest);
+                    }
+                }
+
+                auto values = make_counted<std::vector<Type>>();
+
+                values->reserve(heap.size());
+
+                for (auto& keyed : heap) {
+                    values->push_back(keyed.second);
+                }
+
+                build.arg("rows", values->size());
+                return from_storage<Type>(values);
+            }), plan);
         }
 
         template <typename Functor, typename Result = enumerable<typename functor_retriver<decltype(&Functor::operator())>::type>>
         Result select(const Functor& selector) const
         {
-            return Result (
-                make_select_iterator(begin(), selector),
-                make_select_iterator(end(), selector)
-                );
+            auto plan = stage_plan("select");
+            auto counted_selector = counted(selector, plan);
+
+            return plan_access::attach(Result (
+                make_select_iterator(begin(), counted_selector),
+                make_select_iterator(end(), counted_selector)
+                ), plan);
         }
 
-        template <typename Functor>
-        auto select_many(const Functor& selector) const->enumerable<decltype(*((typename functor_retriver<decltype(&Functor::operator())>::type*)0)->begin())>
+        template <typename Functor,
+                  typename Collection = typename recover_type<typename functor_retriver<decltype(&Functor::operator())>::type>::type,
+                  typename ValueType = typename recover_type<decltype(*std::begin(std::declval<Collection&>()))>::type>
+        enumerable<ValueType> select_many(const Functor& selector) const
         {
-            typedef decltype(*((typename functor_retriver<decltype(&Functor::operator())>::type*)0)->begin()) ValueType;
-            typedef typename functor_retriver<decltype(&Functor::operator())>::type Enumerable;
+            return select_many(selector, [](const Type&, const ValueType& value) { return value; });
+        }
 
-            return select(selector).aggregate(
-                [](const enumerable<ValueType>& left, const Enumerable& right) {
-                return left.concat(right);
-            });
+        template <typename CollectionFunctor,
+                  typename ResultFunctor,
+                  typename ResultType = typename functor_retriver<decltype(&ResultFunctor::operator())>::type>
+        enumerable<ResultType> select_many(const CollectionFunctor& collection_selector, const ResultFunctor& result_selector) const
+        {
+            auto plan = stage_plan("select_many");
+            auto counted_collection_selector = counted(collection_selector, plan);
+
+            return plan_access::attach(enumerable<ResultType> (
+                make_flatten_iterator(begin(), end(), counted_collection_selector, result_selector),
+                make_flatten_iterator(end(), end(), counted_collection_selector, result_selector)
+                ), plan);
         }
 
         template <typename Iterator>
@@ -1652,46 +6737,64 @@ namespace sb {
         Self single(void) const 
         {
             auto it = begin();
-            if (it == end()) {
+            auto last = end();
+
+            if (it == last) {
                 throw enumerable_exception("get a value from an empty collection");
             }
 
-            if (++it != end()) {
+            auto value = *it;
+
+            if (++it != last) {
                 throw enumerable_exception("the collection does not contain exactly one element");
             }
 
-            return *this;
+            return from_values({value});
         }
 
         Self single_or_default(const Type& value) const 
         {
             auto it = begin();
-            if (it == end()) {
+            auto last = end();
+
+            if (it == last) {
                 return from_values({value});
             }
 
-            if (++it != end()) {
+            auto result = *it;
+
+            if (++it != last) {
                 throw enumerable_exception("the collection does not contain exactly one element");
             }
 
-            return *this;
+            return from_values({result});
         }
 
         Self skip(int count) const 
         {
-            return from (
+            if (m_source && m_source->random_access()) {
+                disown();
+                auto size = m_source->size();
+                auto first = std::min(size, static_cast<std::size_t>(std::max(count, 0)));
+                return plan_access::attach(m_source->slice(first, size), stage_plan("skip(" + std::to_string(count) + ")"));
+            }
+
+            return plan_access::attach(Self (
                 make_skip_iterator(begin(), end(), count),
                 make_skip_iterator(end(), end(), count)
-                );
+                ), stage_plan("skip(" + std::to_string(count) + ")"));
         }
 
         template <typename Functor>
         Self skip_while(const Functor& predicate) const 
         {
-            return from (
-                make_skip_while_iterator(begin(), end(), predicate),
-                make_skip_while_iterator(end(), end(), predicate)
-                );
+            auto plan = stage_plan("skip_while");
+            auto counted_predicate = counted(predicate, plan);
+
+            return plan_access::attach(Self (
+                make_skip_while_iterator(begin(), end(), counted_predicate),
+                make_skip_while_iterator(end(), end(), counted_predicate)
+                ), plan);
         }
 
         Type sum(void) const 
@@ -1699,27 +6802,101 @@ namespace sb {
             return aggregate([](const Type& lhs, const Type& rhs) {return lhs + rhs;});
         }
 
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>> sum_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return lhs + rhs; });
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            sum_by(const KeyFunctor& key_selector) const
+        {
+            return sum_by(key_selector, [](const Type& value) { return value; });
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>>
+            sum_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const parallel_policy& policy) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return lhs + rhs; },
+                policy);
+        }
+
+        template <typename KeyFunctor,
+                  typename ValueFunctor,
+                  typename KeyType = typename functor_retriver<decltype(&KeyFunctor::operator())>::type,
+                  typename ValueType = typename functor_retriver<decltype(&ValueFunctor::operator())>::type>
+        enumerable<std::pair<KeyType, ValueType>>
+            sum_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const spill_policy& policy) const
+        {
+            return reduce_by<KeyType, ValueType>(
+                key_selector,
+                value_selector,
+                [](const ValueType& lhs, const ValueType& rhs) { return lhs + rhs; },
+                policy);
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            sum_by(const KeyFunctor& key_selector, const parallel_policy& policy) const
+        {
+            return sum_by(key_selector, [](const Type& value) { return value; }, policy);
+        }
+
+        template <typename KeyFunctor>
+        enumerable<std::pair<typename functor_retriver<decltype(&KeyFunctor::operator())>::type, Type>>
+            sum_by(const KeyFunctor& key_selector, const spill_policy& policy) const
+        {
+            return sum_by(key_selector, [](const Type& value) { return value; }, policy);
+        }
+
         Self take(int count) const 
         {
-            return from(
+            if (m_source && m_source->random_access()) {
+                disown();
+                auto last = std::min(m_source->size(), static_cast<std::size_t>(std::max(count, 0)));
+                return plan_access::attach(m_source->slice(0, last), stage_plan("take(" + std::to_string(count) + ")"));
+            }
+
+            return plan_access::attach(Self(
                 make_take_iterator(begin(), end(), count),
                 make_take_iterator(end(), end(), count)
-                );
+                ), stage_plan("take(" + std::to_string(count) + ")"));
         }
 
         template <typename Functor>
         Self take_while(const Functor& predicate) const 
         {
-            return from(
-                make_take_while_iterator(begin(), end(), predicate),
-                make_take_while_iterator(end(), end(), predicate)
-                );
+            auto plan = stage_plan("take_while");
+            auto counted_predicate = counted(predicate, plan);
+
+            return plan_access::attach(Self(
+                make_take_while_iterator(begin(), end(), counted_predicate),
+                make_take_while_iterator(end(), end(), counted_predicate)
+                ), plan);
         }
 
-        std::vector<Type> to_vector(void) const 
+        std::vector<Type> to_vector(void) const &
         {
             std::vector<Type> values; 
 
+            if (m_source) {
+                values.reserve(m_source->size());
+            }
+
             for (auto it = begin(); it != end(); ++it) {
                 values.push_back(*it);
             }
@@ -1727,6 +6904,22 @@ namespace sb {
             return std::move(values);
         }
 
+        /* an expiring range that is the only owner of its vector hands the vector over */
+        std::vector<Type> to_vector(void) &&
+        {
+            if (m_deferred && m_owned) {
+                return m_deferred->release().to_vector();
+            }
+
+            if (m_storage && m_owned) {
+                auto values = std::move(*m_storage);
+                *this = Self();
+                return values;
+            }
+
+            return to_vector();
+        }
+
         std::list<Type> to_list(void) const 
         {
             std::list<Type> values;
@@ -1750,39 +6943,42 @@ namespace sb {
         }
 
         template <typename Functor> 
-        std::map<typename functor_retriver<decltype(&Functor::operator())>::type, Type> to_map(const Functor& selector) const
+        std::map<typename owned_key<typename functor_retriver<decltype(&Functor::operator())>::type>::type, Type> to_map(const Functor& selector) const
         {
-            std::map<typename functor_retriver<decltype(&Functor::operator())>::type, Type> values;
+            typedef typename owned_key<typename functor_retriver<decltype(&Functor::operator())>::type>::type KeyType;
+            std::map<KeyType, Type> values;
 
             for (auto it = begin(); it != end(); ++it) {
                 auto value = *it;
-                values.insert(std::make_pair(selector(value), value));
+                values.insert(std::make_pair(KeyType(selector(value)), value));
             }
 
             return std::move(values);
         }
 
         template <typename Functor>
-        std::multimap<typename functor_retriver<decltype(&Functor::operator())>::type, Type> to_multimap(const Functor& selector) const
+        std::multimap<typename owned_key<typename functor_retriver<decltype(&Functor::operator())>::type>::type, Type> to_multimap(const Functor& selector) const
         {
-            std::multimap<typename functor_retriver<decltype(&Functor::operator())>::type, Type> values;
+            typedef typename owned_key<typename functor_retriver<decltype(&Functor::operator())>::type>::type KeyType;
+            std::multimap<KeyType, Type> values;
 
             for (auto it = begin(); it != end(); ++it) {
                 auto value = *it;
-                values.insert(std::make_pair(selector(value), value));
+                values.insert(std::make_pair(KeyType(selector(value)), value));
             }
 
             return std::move(values);
         }
 
         template <typename Functor>
-        std::unordered_map<typename functor_retriver<decltype(&Functor::operator())>::type, Type> to_unordered_map(const Functor& selector) const
+        std::unordered_map<typename owned_key<typename functor_retriver<decltype(&Functor::operator())>::type>::type, Type> to_unordered_map(const Functor& selector) const
         {
-            std::unordered_map<typename functor_retriver<decltype(&Functor::operator())>::type, Type> values;
+            typedef typename owned_key<typename functor_retriver<decltype(&Functor::operator())>::type>::type KeyType;
+            std::unordered_map<KeyType, Type> values;
 
             for (auto it = begin(); it != end(); ++it) {
                 auto value = *it;
-                values.insert(std::make_pair(selector(value), value));
+                values.insert(std::make_pair(KeyType(selector(value)), value));
             }
 
             return std::move(values);
@@ -1799,6 +6995,18 @@ namespace sb {
             return std::move(values);
         }
 
+        template <typename Compare>
+        std::set<Type, Compare> to_set(const Compare& compare) const
+        {
+            std::set<Type, Compare> values(compare);
+
+            for (auto it = begin(); it != end(); ++it) {
+                values.insert(*it);
+            }
+
+            return std::move(values);
+        }
+
         std::multiset<Type> to_multiset() const
         {
             std::multiset<Type> values;
@@ -1821,6 +7029,69 @@ namespace sb {
             return std::move(values);
         }
 
+        template <typename Hash, typename Equal>
+        std::unordered_set<Type, Hash, Equal> to_unordered_set(const hash_policy<Hash, Equal>& policy) const
+        {
+            std::unordered_set<Type, Hash, Equal> values(0, policy.hash, policy.equal);
+
+            for (auto it = begin(); it != end(); ++it) {
+                values.insert(*it);
+            }
+
+            return std::move(values);
+        }
+
+        maybe<Type> try_first(void) const
+        {
+            auto it = begin();
+
+            if (it == end()) {
+                return maybe<Type>();
+            }
+
+            return maybe<Type>(*it);
+        }
+
+        maybe<Type> try_last(void) const
+        {
+            maybe<Type> result;
+
+            for (auto it = begin(), last = end(); it != last; ++it) {
+                result = maybe<Type>(*it);
+            }
+
+            return result;
+        }
+
+        maybe<Type> try_max(void) const
+        {
+            return try_extreme([](const Type& lhs, const Type& rhs) { return lhs < rhs; });
+        }
+
+        maybe<Type> try_min(void) const
+        {
+            return try_extreme([](const Type& lhs, const Type& rhs) { return rhs < lhs; });
+        }
+
+        /* the only element, or nothing when the range is empty or holds more than one */
+        maybe<Type> try_single(void) const
+        {
+            auto it = begin();
+            auto last = end();
+
+            if (it == last) {
+                return maybe<Type>();
+            }
+
+            maybe<Type> result(*it);
+
+            if (++it != last) {
+                return maybe<Type>();
+            }
+
+            return result;
+        }
+
         template <typename Iterator>
         Self union_with(const Iterator& right_begin, const Iterator& right_end) const
         {
@@ -1833,18 +7104,51 @@ namespace sb {
             return union_with(std::begin(container), std::end(container));
         }
 
+        template <typename Container, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        Self union_with(Container&& container) const
+        {
+            return union_with(from(std::move(container)));
+        }
+
         Self union_with(const std::initializer_list<Type>& container) const
         {
-            return union_with(std::begin(container), std::end(container));
+            return union_with(from_values(container));
+        }
+
+        template <typename Iterator, typename Hash, typename Equal>
+        Self union_with(const Iterator& right_begin, const Iterator& right_end, const hash_policy<Hash, Equal>& policy) const
+        {
+            return concat(right_begin, right_end).distinct(policy);
+        }
+
+        template <typename Container, typename Hash, typename Equal>
+        Self union_with(const Container& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return union_with(std::begin(container), std::end(container), policy);
+        }
+
+        template <typename Container, typename Hash, typename Equal, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        Self union_with(Container&& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return union_with(from(std::move(container)), policy);
+        }
+
+        template <typename Hash, typename Equal>
+        Self union_with(const std::initializer_list<Type>& container, const hash_policy<Hash, Equal>& policy) const
+        {
+            return union_with(from_values(container), policy);
         }
 
         template <typename Functor>
         Self where(const Functor& predicate) const 
         {
-            return from (
-                make_where_iterator(begin(), end(), predicate),
-                make_where_iterator(end(), end(), predicate)
-                );
+            auto plan = stage_plan("where");
+            auto counted_predicate = counted(predicate, plan);
+
+            return plan_access::attach(Self (
+                make_where_iterator(begin(), end(), counted_predicate),
+                make_where_iterator(end(), end(), counted_predicate)
+                ), plan);
         }
 
         template <typename RightIterator, 
@@ -1852,10 +7156,10 @@ namespace sb {
                   typename RightType = typename recover_type<typename std::iterator_traits<RightIterator>::value_type>::type>
         enumerable<std::pair<LeftType, RightType>> zip(const RightIterator& right_begin, const RightIterator& right_end) const
         {
-            return from (
+            return plan_access::attach(enumerable<std::pair<LeftType, RightType>> (
                 make_zip_iterator(begin(), end(), right_begin, right_end),
                 make_zip_iterator(end(), end(), right_end, right_end)
-                );
+                ), stage_plan("zip", make_plan("from")));
         }
 
         template <typename Container>
@@ -1865,10 +7169,17 @@ namespace sb {
             return zip(std::begin(container), std::end(container));
         }
 
+        template <typename Container, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto zip(Container&& container) const ->
+            enumerable<std::pair<Type, typename recover_type<decltype(*std::begin(container))>::type>>
+        {
+            return zip(from(std::move(container)));
+        }
+
         template <typename RightType>
         enumerable<std::pair<Type, RightType>> zip(const std::initializer_list<RightType>& container) const
         {
-            return zip(std::begin(container), std::end(container));
+            return zip(from_values(container));
         }
 
         template <typename RightIterator,
@@ -1877,24 +7188,419 @@ namespace sb {
                   typename RightType = typename recover_type<typename std::iterator_traits<RightIterator>::value_type>::type>
         enumerable<std::pair<LeftType, RightType>> zip(const RightIterator& right_begin, const RightIterator& right_end, const Functor& selector) const
         {
-            return enumerable<std::pair<LeftType, RightType>> (
-                make_zip_with_iterator(begin(), end(), right_begin, right_end, selector),
-                make_zip_with_iterator(end(), end(), right_end, right_end, selector)
-                );
+            auto plan = stage_plan("zip", make_plan("from"));
+            auto counted_selector = counted(selector, plan);
+
+            return plan_access::attach(enumerable<std::pair<LeftType, RightType>> (
+                make_zip_with_iterator(begin(), end(), right_begin, right_end, counted_selector),
+                make_zip_with_iterator(end(), end(), right_end, right_end, counted_selector)
+                ), plan);
         }
 
         template <typename Container, typename Functor>
-        auto zip(const Container& container, const Functor& selector) ->
+        auto zip(const Container& container, const Functor& selector) const ->
             enumerable<std::pair<typename functor_retriver<decltype(&Functor::operator())>::type, typename recover_type<decltype(*std::begin(container))>::type>>
         {
             return zip(std::begin(container), std::end(container), selector);
         }
 
+        template <typename Container, typename Functor, typename = typename std::enable_if<is_temporary_range<Container>::value>::type>
+        auto zip(Container&& container, const Functor& selector) const ->
+            enumerable<std::pair<typename functor_retriver<decltype(&Functor::operator())>::type, typename recover_type<decltype(*std::begin(container))>::type>>
+        {
+            return zip(from(std::move(container)), selector);
+        }
+
         template <typename RightType, typename Functor>
         enumerable<std::pair<typename functor_retriver<decltype(&Functor::operator())>::type, RightType>> 
             zip(const std::initializer_list<RightType>& container, const Functor& selector) const
         {
-            return zip(std::begin(container), std::end(container), selector);
+            return zip(from_values(container), selector);
+        }
+
+    private:
+        /* a concat contributes its own segments rather than nesting */
+        static void append_segment(std::vector<Self>& segments, const Self& range)
+        {
+            if (range.m_segments) {
+                segments.insert(segments.end(), range.m_segments->begin(), range.m_segments->end());
+
+            } else {
+                segments.push_back(range);
+            }
+        }
+
+        template <typename Container>
+        static void append_segment(std::vector<Self>& segments, const Container& container)
+        {
+            segments.push_back(Self(enumerable_iterator<Type>(std::begin(container)), enumerable_iterator<Type>(std::end(container))));
+        }
+
+        static void append_segments(std::vector<Self>&)
+        {
+        }
+
+        template <typename Container, typename ...Rest>
+        static void append_segments(std::vector<Self>& segments, const Container& container, const Rest&... rest)
+        {
+            append_segment(segments, container);
+            append_segments(segments, rest...);
+        }
+
+        void disown(void) const
+        {
+            if (m_owned.load(std::memory_order_relaxed)) {
+                m_owned.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        static Self concat_segments(const std::shared_ptr<std::vector<Self>>& segments)
+        {
+            std::shared_ptr<const std::vector<Self>> flat(segments);
+            std::vector<std::shared_ptr<const plan_node>> inputs;
+            Self result(make_concat_iterator(flat, 0), make_concat_iterator(flat, flat->size()));
+            result.m_segments = flat;
+
+            for (auto& segment : *flat) {
+                inputs.push_back(segment.input_plan());
+            }
+
+            return plan_access::attach(result, make_plan("concat", inputs));
+        }
+
+        /* the plan this query feeds into the operators built on it, a bare source if it has none */
+        std::shared_ptr<const plan_node> input_plan(void) const
+        {
+            return m_plan ? m_plan : make_plan("from");
+        }
+
+        std::shared_ptr<const plan_node> stage_plan(const std::string& name) const
+        {
+            return make_plan(name, { input_plan() });
+        }
+
+        std::shared_ptr<const plan_node> stage_plan(const std::string& name, const std::shared_ptr<const plan_node>& other) const
+        {
+            return make_plan(name, { input_plan(), other });
+        }
+
+        query_profile run_profile(const hardware_counters* counters) const
+        {
+            auto plan = input_plan();
+            query_profile profile;
+
+            {
+                profile_session session(plan, counters);
+                auto start = std::chrono::steady_clock::now();
+
+                for (auto it = begin(), last = end(); it != last; ++it) {
+                    auto value = *it;
+                    (void)value;
+                    profile.elements++;
+                }
+
+                profile.nanoseconds = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+                profile_plan(plan, 0, session, profile);
+            }
+
+            return profile;
+        }
+
+        Self reversed(void) const
+        {
+            disown();
+
+            if (m_deferred) {
+                auto deferred = m_deferred;
+
+                return defer<Type>([deferred]() -> Self {
+                    stage_scope stage("reverse");
+                    return deferred->get().reversed();
+                });
+            }
+
+            if (m_source) {
+                return m_source->reverse();
+            }
+
+            if (m_segments) {
+                auto segments = make_counted<std::vector<Self>>();
+
+                for (auto it = m_segments->rbegin(); it != m_segments->rend(); ++it) {
+                    segments->push_back(it->reversed());
+                }
+
+                return concat_segments(segments);
+            }
+
+            auto self = *this;
+
+            return defer<Type>([self]() -> Self {
+                stage_scope stage("reverse");
+                return from_storage<Type>(make_counted<std::vector<Type>>(self.to_vector())).reversed();
+            });
+        }
+
+        /* the first element no other element is preferred over, in a single pass */
+        template <typename Functor>
+        maybe<Type> try_extreme(const Functor& less) const
+        {
+            auto it = begin();
+            auto last = end();
+
+            if (it == last) {
+                return maybe<Type>();
+            }
+
+            maybe<Type> result(*it);
+
+            while (++it != last) {
+                auto value = *it;
+
+                if (less(*result, value)) {
+                    *result = value;
+                }
+            }
+
+            return result;
+        }
+
+        /* one accumulator per key, seeded by the first value and folded with reducer */
+        template <typename KeyType, typename ValueType, typename KeyFunctor, typename ValueFunctor, typename Functor>
+        enumerable<std::pair<KeyType, ValueType>>
+            reduce_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const Functor& reducer) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("reduce_by");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_value_selector = counted(value_selector, plan);
+            auto counted_reducer = counted(reducer, plan);
+            auto resource = current_resource();
+
+            return plan_access::attach(defer<std::pair<KeyType, ValueType>>([self, resource, counted_key_selector, counted_value_selector, counted_reducer]() -> enumerable<std::pair<KeyType, ValueType>> {
+                stage_scope stage("reduce_by");
+                trace_span build("reduce_by", "build");
+                auto table = make_arena_shared<flat_map<KeyType, ValueType>>(resource);
+                key_store<KeyType> keys;
+
+                for (auto it = self.begin(); it != self.end(); ++it) {
+                    auto value = *it;
+                    const KeyType& key = counted_key_selector(value);
+                    auto hit = table->find_or_insert(key, [&key, &keys, &value, &counted_value_selector]() { return std::make_pair(keys.keep(key), counted_value_selector(value)); });
+
+                    if (!hit.second) {
+                        hit.first->second = counted_reducer(hit.first->second, counted_value_selector(value));
+                    }
+                }
+
+                build.arg("groups", table->size());
+
+                return from_storage<std::pair<KeyType, ValueType>>(keys.attach(table));
+            }), plan);
+        }
+
+        template <typename KeyType, typename ValueType, typename KeyFunctor, typename ValueFunctor, typename Functor>
+        enumerable<std::pair<KeyType, ValueType>>
+            reduce_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const Functor& reducer, const parallel_policy& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("reduce_by");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_value_selector = counted(value_selector, plan);
+            auto counted_reducer = counted(reducer, plan);
+
+            return plan_access::attach(defer<std::pair<KeyType, ValueType>>([self, counted_key_selector, counted_value_selector, counted_reducer, policy]() -> enumerable<std::pair<KeyType, ValueType>> {
+                stage_scope stage("reduce_by");
+                return from_storage<std::pair<KeyType, ValueType>>(self.template parallel_reduce_by<KeyType, ValueType>(
+                    counted_key_selector,
+                    [&counted_value_selector](const Type& value) { return counted_value_selector(value); },
+                    [&counted_value_selector, &counted_reducer](ValueType& state, const Type& value) { state = counted_reducer(state, counted_value_selector(value)); },
+                    [&counted_reducer](ValueType& state, const ValueType& rhs) { state = counted_reducer(state, rhs); },
+                    policy));
+            }), plan);
+        }
+
+        template <typename KeyType, typename ValueType, typename KeyFunctor, typename ValueFunctor, typename Functor>
+        enumerable<std::pair<KeyType, ValueType>>
+            reduce_by(const KeyFunctor& key_selector, const ValueFunctor& value_selector, const Functor& reducer, const spill_policy& policy) const
+        {
+            auto self = *this;
+            auto plan = stage_plan("reduce_by");
+            auto counted_key_selector = counted(key_selector, plan);
+            auto counted_value_selector = counted(value_selector, plan);
+            auto counted_reducer = counted(reducer, plan);
+
+            return plan_access::attach(defer<std::pair<KeyType, ValueType>>([self, counted_key_selector, counted_value_selector, counted_reducer, policy]() -> enumerable<std::pair<KeyType, ValueType>> {
+                stage_scope stage("reduce_by");
+                return self.template spill_reduce_by<KeyType, ValueType, std::pair<KeyType, ValueType>>(
+                    counted_key_selector,
+                    [&counted_value_selector](const Type& value) { return counted_value_selector(value); },
+                    [&counted_value_selector, &counted_reducer](ValueType& state, const Type& value) { state = counted_reducer(state, counted_value_selector(value)); },
+                    [counted_reducer](ValueType& state, const ValueType& rhs) { state = counted_reducer(state, rhs); },
+                    [](const KeyType& key, ValueType& state) { return std::make_pair(key, state); },
+                    0,
+                    policy);
+            }), plan);
+        }
+
+        /*
+         * every worker folds a contiguous chunk of the source into its own tables, one table per
+         * hash partition; partition p is then merged by worker p in chunk order, so values keep
+         * their source order within a key and no table is ever shared between threads
+         */
+        template <typename KeyType, typename StateType, typename KeyFunctor, typename Create, typename Update, typename Combine>
+        std::shared_ptr<std::vector<std::pair<KeyType, StateType>>>
+            parallel_reduce_by(const KeyFunctor& key_selector,
+                               const Create& create,
+                               const Update& update,
+                               const Combine& combine,
+                               const parallel_policy& policy) const
+        {
+            typedef flat_map<KeyType, StateType> Table;
+
+            static_assert(!key_store<KeyType>::view, "parallel grouping needs owning keys, return std::string rather than string_ref");
+
+            disown();
+            auto source = m_deferred ? m_deferred->get().m_source : m_source;
+
+            if (!source || !source->random_access()) {
+                auto values = make_counted<std::vector<Type>>(to_vector());
+                source = make_source<Type>(values->begin(), values->end(), values);
+            }
+
+            std::size_t size = source->size();
+            std::size_t workers = policy.threads ? policy.threads : std::thread::hardware_concurrency();
+            workers = std::max<std::size_t>(1, std::min<std::size_t>(workers, size));
+
+            std::vector<std::vector<Table>> partials(workers, std::vector<Table>(workers));
+            hasher<KeyType> hash;
+
+            parallel_for(workers, [&](std::size_t worker) {
+                trace_span span("parallel_reduce_by", "chunk");
+                auto& tables = partials[worker];
+                std::size_t last = size * (worker + 1) / workers;
+
+                span.arg("worker", worker);
+                span.arg("rows", last - size * worker / workers);
+
+                for (std::size_t i = size * worker / workers; i < last; ++i) {
+                    auto value = source->at(i);
+                    auto key = key_selector(value);
+                    auto& table = tables[partition_of(hash(key), workers)];
+                    auto hit = table.find_or_insert(key, [&key, &value, &create]() { return std::make_pair(key, create(value)); });
+
+                    if (!hit.second) {
+                        update(hit.first->second, value);
+                    }
+                }
+            });
+
+            parallel_for(workers, [&](std::size_t partition) {
+                trace_span span("parallel_reduce_by", "merge");
+                auto& merged = partials[0][partition];
+
+                span.arg("partition", partition);
+
+                for (std::size_t worker = 1; worker < workers; ++worker) {
+                    for (auto& pair : partials[worker][partition]) {
+                        auto hit = merged.find_or_insert(pair.first, [&pair]() { return std::move(pair); });
+
+                        if (!hit.second) {
+                            combine(hit.first->second, pair.second);
+                        }
+                    }
+
+                    partials[worker][partition] = Table();
+                }
+            });
+
+            auto result = make_counted<std::vector<std::pair<KeyType, StateType>>>();
+
+            for (auto& table : partials[0]) {
+                for (auto& pair : table) {
+                    result->push_back(std::make_pair(pair.first, std::move(pair.second)));
+                }
+            }
+
+            if (policy.ordered) {
+                std::sort(result->begin(), result->end(), [](const std::pair<KeyType, StateType>& lhs, const std::pair<KeyType, StateType>& rhs) {
+                    return lhs.first < rhs.first;
+                });
+            }
+
+            return result;
+        }
+
+        /*
+         * hash aggregation under a memory budget: whenever the estimated size of the partial
+         * table exceeds the budget it is written out to hash partitioned temp files and
+         * cleared; partitions are merged lazily, one at a time, as the result is iterated.
+         * combine and finish outlive the call, so they must not capture locals by reference
+         */
+        template <typename KeyType,
+                  typename StateType,
+                  typename ResultType,
+                  typename KeyFunctor,
+                  typename Create,
+                  typename Update,
+                  typename Combine,
+                  typename Finish>
+        enumerable<ResultType> spill_reduce_by(const KeyFunctor& key_selector,
+                                               const Create& create,
+                                               const Update& update,
+                                               const Combine& combine,
+                                               const Finish& finish,
+                                               std::size_t update_bytes,
+                                               const spill_policy& policy) const
+        {
+            typedef flat_map<KeyType, StateType> Table;
+            typedef spill_storage<KeyType, StateType, ResultType> Storage;
+
+            static_assert(!key_store<KeyType>::view, "spilled grouping needs owning keys, return std::string rather than string_ref");
+
+            const std::size_t entry_bytes = sizeof(typename Table::value_type) + 4 * sizeof(std::uint32_t) + sizeof(std::size_t) + update_bytes;
+            auto storage = make_counted<Storage>(policy.partitions, combine, finish);
+            bool spilled = false;
+            std::size_t bytes = 0;
+            Table table;
+
+            for (auto it = begin(); it != end(); ++it) {
+                auto value = *it;
+                auto key = key_selector(value);
+                auto hit = table.find_or_insert(key, [&key, &value, &create]() { return std::make_pair(key, create(value)); });
+
+                if (hit.second) {
+                    bytes += entry_bytes;
+
+                } else {
+                    update(hit.first->second, value);
+                    bytes += update_bytes;
+                }
+
+                if (bytes > policy.budget) {
+                    storage->spill(table);
+                    table = Table();
+                    spilled = true;
+                    bytes = 0;
+                }
+            }
+
+            if (!spilled) {
+                auto values = make_counted<std::vector<ResultType>>();
+
+                for (auto& pair : table) {
+                    values->push_back(finish(pair.first, pair.second));
+                }
+
+                return from_storage<ResultType>(values);
+            }
+
+            storage->spill(table);
+
+            return enumerable<ResultType>(
+                make_spill_iterator(storage, 0),
+                make_spill_iterator(storage, storage->partitions())
+                );
         }
     };
 
@@ -12,6 +12,7 @@
 #include <map>
 #include <cassert>
 #include <random>
+#include <thread>
 
 void sample(void);
 
@@ -21,7 +22,30 @@ struct student_t
     std::vector<int> scores;
 };
 
-int main(void)
+/* counts its copies, so a sample can tell a handed over vector from a copied one */
+struct tracked_t
+{
+    static int copies;
+    int value;
+
+    tracked_t(int value = 0) : value(value) {}
+    tracked_t(const tracked_t& rhs) : value(rhs.value) { ++copies; }
+    tracked_t& operator=(const tracked_t& rhs) { value = rhs.value; ++copies; return *this; }
+    bool operator==(const tracked_t& rhs) const { return value == rhs.value; }
+    tracked_t operator+(const tracked_t& rhs) const { return tracked_t(value + rhs.value); }
+};
+
+int tracked_t::copies = 0;
+
+namespace sb {
+    template <>
+    struct serializer<tracked_t> {
+        static void write(std::FILE* file, const tracked_t& value) { serializer<int>::write(file, value.value); }
+        static void read(std::FILE* file, tracked_t& value) { serializer<int>::read(file, value.value); }
+    };
+}
+
+int main(int argc, char* argv[])
 {
     std::vector<student_t> students =
     {
@@ -33,16 +57,23 @@ int main(void)
     };
 
     auto scores = sb::from(students).
-        where([](const student_t& student) {
-           return std::accumulate(student.scores.begin(), student.scores.end(), 0) / 4 > 90;
-        }).select([](const student_t& student){
-            return std::make_pair(student.last_name, std::accumulate(student.scores.begin(), student.scores.end(), 0) / 4); 
+        let([](const student_t& student) {
+           return std::accumulate(student.scores.begin(), student.scores.end(), 0) / 4;
+        }).where([](const sb::let_value<student_t, int>& student) {
+           return student.value() > 90;
+        }).select([](const sb::let_value<student_t, int>& student){
+            return std::make_pair(student.element().last_name, student.value()); 
         });
 
     for (auto x : scores) {
         printf("%s score: %i\n", x.first.c_str(), x.second);
     }
 
+    // make test and make accounting run the samples
+    if (argc > 1 && std::string(argv[1]) == "test") {
+        sample();
+    }
+
     return 0;
 }
 
@@ -71,6 +102,46 @@ void sample(void)
         std::cout << std::endl;
     }
 
+    {
+        // test from_random
+        std::cout << "test from_random(seeded):" << std::endl;
+        auto dice = sb::from_random(sb::uniform_int<int>(1, 6), sb::seeded(42)).take(300);
+        auto rolls = dice.to_vector();
+        assert(rolls == dice.to_vector() && sb::from(rolls).min() == 1 && sb::from(rolls).max() == 6);
+        std::copy(rolls.begin(), rolls.begin() + 10, std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+
+        std::cout << "test from_random(distribution, engine):" << std::endl;
+        auto heights = sb::from_random(sb::normal<double>(170, 10), sb::seeded<sb::pcg32>(7)).take(1000);
+        auto mean = heights.aggregate(0.0, [](double sum, double x) { return sum + x; }) / 1000;
+        assert(mean > 168 && mean < 172);
+        auto low = sb::from_random<unsigned int>(sb::seeded<sb::pcg32>(7)).take(8).to_vector();
+        auto high = sb::from_random<unsigned int>(sb::seeded<sb::pcg32>(7 + (1ULL << 32))).take(8).to_vector();
+        assert(low != high);
+        assert(sb::from_random(sb::uniform_real<double>(0, 1), sb::seeded<std::mt19937_64>(1)).take(1000).all([](double x) { return x >= 0 && x < 1; }));
+        std::cout << mean << std::endl;
+
+        std::cout << "test from_random(entropy):" << std::endl;
+        std::cout << sb::from_random<unsigned int>(sb::entropy()).take(3).count() << std::endl;
+
+        std::cout << "test from_random, interleaved and concurrent passes:" << std::endl;
+        auto noise = sb::from_random(sb::uniform_int<int>(0, 999), sb::seeded(3)).take(2000);
+        auto first = noise.begin();
+        auto second = noise.begin();
+        auto same = true;
+        for (auto i = 0; i < 1000; ++i, ++first) {
+            same = same && *first == *second;
+            ++second;
+        }
+        std::vector<int> passes[2];
+        std::thread left([&]() { passes[0] = noise.to_vector(); });
+        std::thread right([&]() { passes[1] = noise.to_vector(); });
+        left.join();
+        right.join();
+        assert(same && passes[0] == passes[1] && passes[0] == noise.to_vector());
+        std::cout << passes[0].size() << std::endl;
+    }
+
     {
         // test from 
         std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
@@ -88,6 +159,67 @@ void sample(void)
             std::cout << value << " ";
         }
         std::cout << std::endl;
+
+        std::cout << "test from(container&&), to_vector() &&:" << std::endl;
+        auto batch = std::vector<int>(v.rbegin(), v.rend());
+        auto data = batch.data();
+        auto linq = sb::from(std::move(batch));
+        auto values = std::move(linq).to_vector();
+        std::copy(values.begin(), values.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl << (values.data() == data) << " " << linq.count() << std::endl;
+
+        // a range that was copied or handed out its iterators no longer owns its vector, so it is copied
+        auto kept = sb::from(std::vector<int>(v));
+        auto copy = kept;
+        auto copied = std::move(kept).to_vector();
+        auto iterated = sb::from(std::vector<int>(v));
+        auto it = iterated.begin();
+        auto sorted = sb::from(v).order_by([](int x) { return -x; });
+        assert(copied == v && copy.to_vector() == v && std::move(iterated).to_vector() == v && *it == 0);
+        assert(std::move(sorted).to_vector().front() == 9);
+
+        // operators that build their own result vector hand it over too, so it costs one copy per row less
+        std::vector<tracked_t> items(v.begin(), v.end());
+        auto tracked_hash = sb::hashing([](const tracked_t& x) { return std::hash<int>()(x.value); });
+        auto common = [&]() { return sb::from(items).intersect_with(std::vector<tracked_t>{ 3, 1, 4 }, tracked_hash); };
+        auto sums = [&]() { return sb::from(items).sum_by([](const tracked_t& x) { return x.value % 3; }, [](const tracked_t& x) { return x; }, sb::spill(1 << 20, 2)); };
+        auto shared_common = common();
+        auto shared_sums = sums();
+        auto mark = tracked_t::copies;
+        auto common_copied = shared_common.to_vector();
+        auto sums_copied = shared_sums.to_vector();
+        auto copies = tracked_t::copies - mark;
+        mark = tracked_t::copies;
+        auto common_values = common().to_vector();
+        auto sum_values = sums().to_vector();
+        auto handed_copies = tracked_t::copies - mark;
+        assert(common_values == common_copied && common_values.size() == 3 && sum_values.size() == sums_copied.size() && sum_values.front().second.value == 18);
+        assert(handed_copies + common_values.size() + sum_values.size() <= static_cast<std::size_t>(copies));
+    }
+
+    {
+        // test range, repeat
+        std::cout << "test range(start, count, step):" << std::endl;
+        auto evens = sb::range(0, 10, 2);
+        std::copy(evens.begin(), evens.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+        assert(evens.count() == 10 && evens.element_at(3) == 6 && evens.skip(8).first() == 16 && evens.reverse().first() == 18);
+
+        auto ids = sb::range<long long>(0, 3000000000LL);
+        assert(ids.skip(2000000000).take(2).last() == 2000000001LL && ids.element_at(2147483647) == 2147483647LL && ids.reverse().first() == 2999999999LL);
+        assert(ids.long_count() == 3000000000ULL && evens.long_count() == 10);
+        try {
+            ids.count();
+            assert(false);
+        } catch (const sb::enumerable_exception&) {
+        }
+        assert(sb::range(0, 1000).group_by([](int x) { return x % 3; }, sb::parallel(4, true)).first().second.count() == 334);
+
+        std::cout << "test repeat(value, count):" << std::endl;
+        auto dashes = sb::repeat(std::string("-"), 5);
+        std::copy(dashes.begin(), dashes.end(), std::ostream_iterator<std::string>(std::cout, " "));
+        std::cout << std::endl;
+        assert(dashes.count() == 5 && dashes.skip(4).count() == 1 && dashes.skip(9).count() == 0);
     }
 
     {
@@ -103,6 +235,15 @@ void sample(void)
         std::cout << sb::from(v).aggregate(5, [](int x, int y){return x + y; }, [](int x){return std::string(x, 'H'); }) << std::endl;
     }
 
+    {
+        // test aggregate_by
+        std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+        std::cout << "test aggregate_by(key_selector, reducer):" << std::endl;
+        for (auto pair : sb::from(v).aggregate_by([](int x) {return x % 3; }, [](int x, int y) {return x * 10 + y; })) {
+            std::cout << "key: " << pair.first << " value: " << pair.second << std::endl;
+        }
+    }
+
     {
         // test all, any
         std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
@@ -124,6 +265,34 @@ void sample(void)
         std::cout << sb::from(v).average<double>() << std::endl;
     }
 
+    {
+        // test buffer
+        std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+        int selected = 0;
+
+        std::cout << "test buffer():" << std::endl;
+        auto linq = sb::from(v).select([&selected](int x) { ++selected; return x * x; }).buffer();
+        auto count = linq.count();
+        auto sum = linq.sum();
+        std::cout << count << " " << sum << " " << selected << std::endl;
+
+        std::cout << "test buffer(limit):" << std::endl;
+        selected = 0;
+        linq = sb::from(v).select([&selected](int x) { ++selected; return x * x; }).buffer(4);
+        count = linq.count();
+        sum = linq.sum();
+        std::cout << count << " " << sum << " " << selected << std::endl;
+
+        // threads share the cache and read the positions past the limit from their own cursors
+        auto shared = sb::range(0, 1000).select([](int x) { return x; }).buffer(300);
+        int sums[2] = { 0, 0 };
+        std::thread left([&]() { sums[0] = shared.sum(); });
+        std::thread right([&]() { sums[1] = shared.sum(); });
+        left.join();
+        right.join();
+        assert(sums[0] == 499500 && sums[1] == 499500 && shared.skip(299).take(3).sum() == 300 + 299 + 301);
+    }
+
     {
         //test concat
         std::vector<int> v1 = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
@@ -144,6 +313,55 @@ void sample(void)
         linq = linq.concat({ 14, 15, 16 });
         std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
         std::cout << std::endl;
+
+        std::cout << "test concat(range, range, ...):" << std::endl;
+        linq = sb::from(v1).concat(v3, v2, v3);
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+
+        std::cout << "test concat(ranges):" << std::endl;
+        std::vector<sb::enumerable<int>> shards;
+        for (auto i = 0; i < 4; ++i) {
+            shards.push_back(sb::from_values({ i, i * 10 }));
+        }
+        linq = sb::concat(shards);
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+    }
+
+    {
+        // test count_by
+        std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+        std::cout << "test count_by(key_selector):" << std::endl;
+        for (auto pair : sb::from(v).count_by([](int x) {return x % 3; })) {
+            std::cout << "key: " << pair.first << " count: " << pair.second << std::endl;
+        }
+
+        std::cout << "test count_by(key_selector, parallel_policy):" << std::endl;
+        for (auto pair : sb::from(v).count_by([](int x) {return x % 3; }, sb::parallel(4, true))) {
+            std::cout << "key: " << pair.first << " count: " << pair.second << std::endl;
+        }
+
+        std::cout << "test count_by(key_selector, spill_policy):" << std::endl;
+        for (auto pair : sb::from(v).count_by([](int x) {return x % 3; }, sb::spill(64, 2))) {
+            std::cout << "key: " << pair.first << " count: " << pair.second << std::endl;
+        }
+
+        // iterators of a spilled result read their partitions independently, also from several threads
+        auto spilled = sb::range(0, 5000).count_by([](int x) { return x % 97; }, sb::spill(256, 4));
+        auto first = spilled.begin();
+        auto second = spilled.begin();
+        auto total = 0;
+        for (; first != spilled.end(); ++first, ++second) {
+            assert(*first == *second);
+            total += (*first).second;
+        }
+        std::vector<std::pair<int, int>> passes[2];
+        std::thread left([&]() { passes[0] = spilled.to_vector(); });
+        std::thread right([&]() { passes[1] = spilled.to_vector(); });
+        left.join();
+        right.join();
+        assert(total == 5000 && passes[0].size() == 97 && passes[0] == passes[1]);
     }
 
     {
@@ -169,6 +387,67 @@ void sample(void)
         std::cout << std::endl;
     }
 
+    {
+        // test defer
+        std::vector<int> v = { 3, 1, 4, 1, 5, 9, 2, 6, 5, 3 };
+        int scanned = 0;
+        auto key = [&scanned](int x) { ++scanned; return x; };
+
+        std::cout << "test defer: queries do no work until iterated:" << std::endl;
+        auto linq = sb::from(v).where(key).order_by(key).distinct().skip(2);
+        std::cout << scanned << std::endl;
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+
+        std::cout << "test defer(factory):" << std::endl;
+        linq = sb::defer<int>([&v]() { return sb::from_values(v).skip(8); });
+        v.push_back(7);
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+    }
+
+    {
+        // test sharing a query between threads before its first iteration
+        std::vector<int> v;
+        for (auto i = 0; i < 1000; ++i) {
+            v.push_back(i);
+        }
+
+        std::cout << "test sharing a query between threads:" << std::endl;
+        auto linq = sb::from(v).where([](int x) { return x % 3 == 0; }).skip(2).skip_while([](int x) { return x < 30; })
+            .let([](int x) { return x * 2; }).select([](const sb::let_value<int, int>& x) { return x.value(); })
+            .select_many([](int x) { return std::vector<int>{ x, x + 1 }; }).concat(std::vector<int>{ 1, 2 });
+        int counts[2] = { 0, 0 };
+        std::thread first([&]() { counts[0] = linq.count(); });
+        std::thread second([&]() { counts[1] = linq.count(); });
+        first.join();
+        second.join();
+        assert(counts[0] == counts[1] && counts[0] == 650);
+        std::cout << counts[0] << std::endl;
+    }
+
+    {
+        // test resource_scope
+        std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 2, 4, 6, 8 };
+        auto arena = std::make_shared<sb::monotonic_resource>();
+        std::weak_ptr<sb::memory_resource> watch = arena;
+
+        std::cout << "test resource_scope(resource):" << std::endl;
+        auto linq = sb::enumerable<std::pair<int, sb::enumerable<int>>>();
+        {
+            sb::resource_scope scope(arena);
+            linq = sb::from(v).distinct().group_by([](int x) { return x % 3; });
+        }
+        arena.reset();
+        for (auto group : linq) {
+            std::cout << group.first << ": ";
+            std::copy(group.second.begin(), group.second.end(), std::ostream_iterator<int>(std::cout, " "));
+        }
+        std::cout << std::endl;
+        linq = sb::enumerable<std::pair<int, sb::enumerable<int>>>();
+        std::cout << watch.expired() << std::endl;
+    }
+
     {
         // test distinct
         std::vector<int> v = { 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9 };
@@ -176,6 +455,12 @@ void sample(void)
         std::cout << "test distinct():" << std::endl;
         std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
         std::cout << std::endl;
+
+        // keys already carry a good hash, so skip std::hash and compare with ==
+        linq = sb::from(v).distinct(sb::hashing([](int x) { return static_cast<std::size_t>(x) * 0x9E3779B9u; }));
+        std::cout << "test distinct(hashing(hash)):" << std::endl;
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
     }
 
     {
@@ -199,6 +484,45 @@ void sample(void)
         std::cout << std::endl;
     }
 
+    {
+        // test temporary containers, which the query keeps alive
+        std::vector<int> v = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        auto odds = [](int count) {
+            std::vector<int> values;
+            for (auto i = 0; i < count; ++i) {
+                values.push_back(i * 2 + 1);
+            }
+            return values;
+        };
+        auto parity = [](int x) { return x % 2; };
+
+        std::cout << "test except_with(container&&), intersect_with(container&&), union_with(container&&):" << std::endl;
+        auto evens = sb::from(v).except_with(odds(5));
+        auto common = sb::from(v).intersect_with(odds(5), sb::hashing(std::hash<int>()));
+        auto both = sb::from(v).union_with(odds(6));
+        auto more = sb::from(v).concat(odds(2));
+        std::cout << evens.count() << " " << common.count() << " " << both.count() << " " << more.count() << std::endl;
+        assert(evens.sum() == 20 && common.sum() == 16 && both.count() == 10 && more.last() == 3);
+
+        std::cout << "test join(container&&), group_join(container&&), full_join(container&&), zip(container&&):" << std::endl;
+        auto joined = sb::from(v).join(odds(3), parity, parity);
+        auto grouped = sb::from(v).group_join(odds(3), parity, parity);
+        auto full = sb::from(v).full_join(odds(3), parity, parity, sb::hashing(std::hash<int>()));
+        auto zipped = sb::from(v).zip(odds(3));
+        std::cout << joined.count() << " " << grouped.count() << " " << full.count() << " " << zipped.count() << std::endl;
+        assert(joined.count() == 12 && grouped.first().second.second.count() == 3 && full.count() == 2 && zipped.last().second == 5);
+    }
+
+    {
+        // test explain
+        std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+        auto linq = sb::from(v).where([](int x){ return x % 2 == 0; }).select([](int x){ return x * x; }).take(3);
+
+        std::cout << "test explain():" << std::endl;
+        std::cout << linq.explain();
+        assert(linq.explain() == "take(3)\n  select\n    where\n      from\n");
+    }
+
     {
         // test find
         std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
@@ -261,6 +585,45 @@ void sample(void)
             std::cout << "right join: "; std::copy(pair.second.second.begin(), pair.second.second.end(), std::ostream_iterator<int>(std::cout, " "));
             std::cout << std::endl;
         }
+
+        // a row found only in the inner range is filed under its own key, not a neighbouring outer key
+        std::cout << "test full_join, inner-only keys:" << std::endl;
+        auto identity = [](int x) { return x; };
+        auto rows = sb::from({ 1, 5 }).full_join({ 3, 5 }, identity, identity).to_vector();
+        typedef decltype(rows)::value_type row_t;
+        for (auto& row : rows) {
+            std::cout << row.first << ":" << row.second.first.count() << "," << row.second.second.count() << " ";
+        }
+        std::cout << std::endl;
+        auto inner_only = std::find_if(rows.begin(), rows.end(), [](const row_t& row) { return row.second.first.empty(); });
+        assert(rows.size() == 3 && inner_only->first == 3 && inner_only->second.second.count() == 1 && inner_only->second.second.first() == 3);
+
+        // inner-only keys past the last outer key are kept
+        auto tail = sb::from({ 1, 2 }).full_join({ 2, 7, 9 }, identity, identity).select([](const row_t& row) { return row.first; }).to_vector();
+        std::copy(tail.begin(), tail.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+        assert(tail.size() == 4 && sb::from(tail).contains(7) && sb::from(tail).contains(9));
+    }
+
+    {
+        // test group_aggregate
+        std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+        std::cout << "test group_aggregate(key_selector, seed, reducer):" << std::endl;
+        auto linq = sb::from(v).group_aggregate([](int x) {return x % 2; }, std::string(), [](const std::string& s, int x) {return s + std::to_string(x); });
+        for (auto pair : linq) {
+            std::cout << "key: " << pair.first << " value: " << pair.second << std::endl;
+        }
+
+        std::cout << "test group_aggregate(key_selector, seed, reducer, combiner, parallel_policy):" << std::endl;
+        linq = sb::from(v).group_aggregate(
+            [](int x) {return x % 2; },
+            std::string(),
+            [](const std::string& s, int x) {return s + std::to_string(x); },
+            [](const std::string& lhs, const std::string& rhs) {return lhs + rhs; },
+            sb::parallel(3, true));
+        for (auto pair : linq) {
+            std::cout << "key: " << pair.first << " value: " << pair.second << std::endl;
+        }
     }
 
     {
@@ -273,6 +636,10 @@ void sample(void)
             std::copy(pair.second.begin(), pair.second.end(), std::ostream_iterator<int>(std::cout, " "));
             std::cout << std::endl;
         }
+
+        // groups come out in first-seen key order; sorting them restores the order of earlier versions
+        auto sorted = sb::from({ 7, 3, 9, 4 }).group_by([](int x) { return x % 3; }).order_by([](const std::pair<int, sb::enumerable<int>>& group) { return group.first; });
+        assert(sorted.first().first == 0 && sorted.last().first == 1 && sb::from({ 7, 3, 9, 4 }).group_by([](int x) { return x % 3; }).first().first == 1);
       
         std::cout << "test group_by(key_selector, value_selector):" << std::endl;
         for (auto pair : sb::from(v).group_by([](int x) {return x % 2; }, [](int x){return x * x;})) {
@@ -281,6 +648,39 @@ void sample(void)
             std::copy(pair.second.begin(), pair.second.end(), std::ostream_iterator<int>(std::cout, " "));
             std::cout << std::endl;
         }
+
+        std::cout << "test group_by(key_selector, parallel_policy):" << std::endl;
+        for (auto pair : sb::from(v).group_by([](int x) {return x % 3; }, sb::parallel(4, true))) {
+            std::cout << "key: " << pair.first << " ";
+            std::cout << "value: ";
+            std::copy(pair.second.begin(), pair.second.end(), std::ostream_iterator<int>(std::cout, " "));
+            std::cout << std::endl;
+        }
+
+        std::cout << "test group_by(key_selector, spill_policy):" << std::endl;
+        for (auto pair : sb::from(v).group_by([](int x) {return x % 3; }, sb::spill(64, 2))) {
+            std::cout << "key: " << pair.first << " ";
+            std::cout << "value: ";
+            std::copy(pair.second.begin(), pair.second.end(), std::ostream_iterator<int>(std::cout, " "));
+            std::cout << std::endl;
+        }
+
+        // keys are views into the elements, copied once per distinct key
+        std::vector<std::string> words = { "apple", "avocado", "banana", "blueberry", "cherry" };
+        std::cout << "test group_by(string_ref key_selector):" << std::endl;
+        for (auto pair : sb::from(words).group_by([](const std::string& word) { return sb::string_ref(word.data(), 1); })) {
+            std::cout << "key: " << pair.first << " ";
+            std::cout << "value: ";
+            std::copy(pair.second.begin(), pair.second.end(), std::ostream_iterator<std::string>(std::cout, " "));
+            std::cout << std::endl;
+        }
+
+        sb::intern_pool pool;
+        auto ids = sb::from(words).select([&pool](const std::string& word) { return pool.id(sb::string_ref(word.data(), 1)); }).to_vector();
+        assert(pool.size() == 3 && ids[1] == 0 && pool[ids[4]] == "c");
+
+        sb::intern_pool empty_first;
+        assert(empty_first.id(sb::string_ref("", 0)) == 0 && empty_first.id(sb::string_ref("a", 1)) == 1 && empty_first[0].size() == 0);
     }
 
     {
@@ -364,6 +764,16 @@ void sample(void)
             std::cout << "outer join: " << pair.second.first << std::endl;
             std::cout << "inner join: " << pair.second.second << std::endl;
         }
+
+        std::cout << "test join(container, outer_key_selector, inner_key_selector, hashing(hash, equal)):" << std::endl;
+        auto parity = sb::hashing([](int key) { return static_cast<std::size_t>(key & 1); }, [](int lhs, int rhs) { return (lhs & 1) == (rhs & 1); });
+        linq = sb::from(v1).join(v2, [](int x){return x; }, [](int x){return x; }, parity);
+        assert(linq.count() == 25);
+        for (auto pair : linq.take(3)) {
+            std::cout << "key: " << pair.first << std::endl;
+            std::cout << "outer join: " << pair.second.first << std::endl;
+            std::cout << "inner join: " << pair.second.second << std::endl;
+        }
     }
 
     {
@@ -381,6 +791,20 @@ void sample(void)
         std::cout << sb::from(std::vector<int>()).last_or_default(1024) << std::endl;
     }
 
+    {
+        // test let
+        std::vector<std::string> v = { "17", "4", "230", "42", "8" };
+        int parsed = 0;
+
+        std::cout << "test let(selector):" << std::endl;
+        auto linq = sb::from(v).let([&parsed](const std::string& text) { ++parsed; return std::stoi(text); })
+            .where([](const sb::let_value<std::string, int>& x) { return x.value() > 5; })
+            .order_by([](const sb::let_value<std::string, int>& x) { return x.value(); })
+            .select([](const sb::let_value<std::string, int>& x) { return x.element() + "=" + std::to_string(x.value()); });
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<std::string>(std::cout, " "));
+        std::cout << std::endl << parsed << std::endl;
+    }
+
     {
         // test max
         std::vector<int> v = { 7, 3, 6, 8, 0, 9, 7, 4, 5 };
@@ -388,6 +812,20 @@ void sample(void)
         std::cout << sb::from(v).max() << std::endl;
     }
 
+    {
+        // test max_by_key
+        std::vector<int> v = { 7, 3, 6, 8, 0, 9, 7, 4, 5 };
+        std::cout << "test max_by_key(key_selector):" << std::endl;
+        for (auto pair : sb::from(v).max_by_key([](int x) {return x % 2; })) {
+            std::cout << "key: " << pair.first << " max: " << pair.second << std::endl;
+        }
+
+        std::cout << "test max_by_key(key_selector, value_selector):" << std::endl;
+        for (auto pair : sb::from(v).max_by_key([](int x) {return x % 2; }, [](int x) {return -x; })) {
+            std::cout << "key: " << pair.first << " max: " << pair.second << std::endl;
+        }
+    }
+
     {
         // test min
         std::vector<int> v = { 7, 3, 6, 8, 0, 9, 7, 4, 5 };
@@ -395,6 +833,20 @@ void sample(void)
         std::cout << sb::from(v).min() << std::endl;
     }
 
+    {
+        // test min_by_key
+        std::vector<int> v = { 7, 3, 6, 8, 0, 9, 7, 4, 5 };
+        std::cout << "test min_by_key(key_selector):" << std::endl;
+        for (auto pair : sb::from(v).min_by_key([](int x) {return x % 2; })) {
+            std::cout << "key: " << pair.first << " min: " << pair.second << std::endl;
+        }
+
+        std::cout << "test min_by_key(key_selector, value_selector):" << std::endl;
+        for (auto pair : sb::from(v).min_by_key([](int x) {return x % 2; }, [](int x) {return -x; })) {
+            std::cout << "key: " << pair.first << " min: " << pair.second << std::endl;
+        }
+    }
+
     {
         // test order
         std::vector<int> v = { 7, 3, 6, 8, 0, 9, 7, 4, 5 };
@@ -417,6 +869,28 @@ void sample(void)
         std::cout << std::endl;
     }
 
+    {
+        // test profile
+        std::vector<int> v = { 7, 3, 6, 8, 0, 9, 7, 4, 5 };
+        auto linq = sb::from(v).where([](int x){ return x > 3; }).order_by([](int x){ return x; });
+
+        std::cout << "test profile():" << std::endl;
+        auto profile = linq.profile();
+        assert(profile.elements == 7 && profile.stages.size() == 3);
+        assert(profile.stages[0].name == "order_by" && profile.stages[0].elements_in == 7 && profile.stages[0].elements_out == 7);
+        assert(profile.stages[1].name == "where" && profile.stages[1].elements_in == 9 && profile.stages[1].invocations == 9);
+        for (auto& stage : profile.stages) {
+            std::cout << std::string(2 * stage.depth, ' ') << stage.name << ": " << stage.elements_in << " in, " << stage.elements_out << " out" << std::endl;
+        }
+
+        std::cout << "test profile(hardware):" << std::endl;
+        auto sampled = sb::from(v).where([](int x){ return x > 3; }).order_by([](int x){ return x; }).profile(sb::hardware());
+        bool counted = std::find(sampled.counted, sampled.counted + sb::hardware_counters::events, true) != sampled.counted + sb::hardware_counters::events;
+        assert(sampled.elements == 7 && sampled.stages[1].invocations == 9);
+        assert(counted || !sampled.counter_status.empty());
+        std::cout << sampled.stages.size() << " stages" << std::endl;
+    }
+
     {
         // test reverse 
         std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
@@ -425,6 +899,48 @@ void sample(void)
         auto linq = sb::from(v).reverse();
         std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
         std::cout << std::endl;
+
+        std::cout << "test reverse().take(count):" << std::endl;
+        linq = sb::from(v).reverse().take(3);
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+
+        std::cout << "test reverse() on a materialized result:" << std::endl;
+        linq = sb::from(v).order_by([](int x) { return x % 3; }).reverse();
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+
+        std::cout << "test reverse() on a lazy pipeline:" << std::endl;
+        linq = sb::from(v).where([](int x) { return x % 2 == 0; }).reverse().reverse();
+        std::copy(linq.begin(), linq.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+    }
+
+    {
+        // test sample, sample_fraction, sample_weighted
+        std::vector<int> v;
+        for (auto i = 0; i < 1000; ++i) {
+            v.push_back(i);
+        }
+
+        std::cout << "test sample(count):" << std::endl;
+        auto picked = sb::from(v).sample(5, sb::seeded(1)).to_vector();
+        assert(picked.size() == 5 && picked == sb::from(v).sample(5, sb::seeded(1)).to_vector());
+        assert(sb::from(v).take(3).sample(5).count() == 3 && sb::from(picked).distinct().count() == 5);
+        std::copy(picked.begin(), picked.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
+
+        std::cout << "test sample_fraction(fraction):" << std::endl;
+        auto kept = sb::from(v).sample_fraction(0.1, sb::seeded(2));
+        assert(kept.count() == kept.count() && kept.count() > 50 && kept.count() < 150);
+        assert(sb::from(v).sample_fraction(1).count() == 1000 && sb::from(v).sample_fraction(0).count() == 0);
+        std::cout << kept.count() << std::endl;
+
+        std::cout << "test sample_weighted(count, weight_selector):" << std::endl;
+        auto odd = sb::from(v).sample_weighted(10, [](int x) { return x % 2; }, sb::seeded(3));
+        assert(odd.count() == 10 && odd.all([](int x) { return x % 2 == 1; }));
+        std::copy(odd.begin(), odd.end(), std::ostream_iterator<int>(std::cout, " "));
+        std::cout << std::endl;
     }
 
     {
@@ -448,6 +964,14 @@ void sample(void)
             std::copy(xs.begin(), xs.end(), std::ostream_iterator<char>(std::cout));
             std::cout << std::endl;
         }
+
+        std::cout << "test select_many(collection_selector, result_selector):" << std::endl;
+        auto pairs = sb::from(v).select_many(
+            [](int x) { return std::vector<int>(x % 3, x); },
+            [](int outer, int inner) { return std::make_pair(outer, inner * 10); });
+        for (auto pair : pairs) {
+            std::cout << "outer: " << pair.first << " inner: " << pair.second << std::endl;
+        }
     }
 
     {
@@ -516,6 +1040,25 @@ void sample(void)
         std::cout << sb::from(v).sum() << std::endl;
     }
 
+    {
+        // test sum_by
+        std::vector<int> v = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+        std::cout << "test sum_by(key_selector):" << std::endl;
+        for (auto pair : sb::from(v).sum_by([](int x) {return x % 2; })) {
+            std::cout << "key: " << pair.first << " sum: " << pair.second << std::endl;
+        }
+
+        std::cout << "test sum_by(key_selector, value_selector):" << std::endl;
+        for (auto pair : sb::from(v).sum_by([](int x) {return x % 2; }, [](int x) {return x * 0.5; })) {
+            std::cout << "key: " << pair.first << " sum: " << pair.second << std::endl;
+        }
+
+        std::cout << "test sum_by(key_selector, parallel_policy):" << std::endl;
+        for (auto pair : sb::from(v).where([](int x) {return x > 2; }).sum_by([](int x) {return x % 2; }, sb::parallel(2, true))) {
+            std::cout << "key: " << pair.first << " sum: " << pair.second << std::endl;
+        }
+    }
+
     {
         // test take
         std::vector<int> v = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
@@ -618,6 +1161,42 @@ void sample(void)
         std::cout << std::endl;
     }
 
+    {
+        // test trace
+        std::vector<int> v = { 7, 3, 6, 8, 0, 9, 7, 4, 5 };
+        std::vector<std::pair<int, std::string>> names = { { 0, "zero" }, { 1, "one" }, { 2, "two" } };
+        sb::trace_recorder recorder;
+
+        std::cout << "test trace:" << std::endl;
+        {
+            sb::trace_scope scope(recorder);
+            sb::from(v).group_by([](int x) { return x % 3; }, sb::parallel(2)).count();
+            sb::from(v).join(names, [](int x) { return x % 3; }, [](const std::pair<int, std::string>& row) { return row.first; }).count();
+        }
+        sb::from(v).order_by([](int x) { return x; }).count();
+
+        std::ostringstream out;
+        recorder.write(out);
+        auto json = out.str();
+        std::cout << recorder.events().size() << " events" << std::endl;
+        assert(json.find("{\"traceEvents\":[") == 0);
+        assert(json.find("\"parallel_reduce_by chunk\"") != std::string::npos && json.find("\"parallel_reduce_by merge\"") != std::string::npos);
+        assert(json.find("\"full_join build\"") != std::string::npos && json.find("\"join probe\"") != std::string::npos);
+        assert(json.find("order_by") == std::string::npos);
+    }
+
+    {
+        // test try_first, try_last, try_max, try_min, try_single
+        std::vector<int> v = { 3, 1, 4, 1, 5, 9, 2, 6 };
+        std::vector<int> empty;
+
+        std::cout << "test try_first(), try_last(), try_max(), try_min(), try_single():" << std::endl;
+        auto linq = sb::from(v).where([](int x) { return x > 2; });
+        std::cout << *linq.try_first() << " " << *linq.try_last() << " " << *linq.try_max() << " " << *linq.try_min() << std::endl;
+        std::cout << sb::from(empty).try_first().has_value() << " " << sb::from(empty).try_max().value_or(1024) << std::endl;
+        std::cout << linq.try_single().has_value() << " " << linq.where([](int x) { return x > 8; }).try_single().value() << std::endl;
+    }
+
     {
         // test union_with
         std::vector<int> v1 = { 0, 1, 2, 3, 4, 5, 6, 7 };
@@ -689,4 +1268,44 @@ void sample(void)
             std::cout << "key: " << pair.first << " value: " << pair.second << std::endl;
         }
     }
+
+#ifdef ENUMERABLE_ACCOUNTING
+    {
+        // test allocation budgets
+        std::vector<int> v;
+        for (int i = 0; i < 100; i++) {
+            v.push_back(i);
+        }
+
+        std::cout << "test allocation_report() after from(container):" << std::endl;
+        sb::reset_allocation_report();
+        int sum = 0;
+        for (auto x : sb::from(v)) {
+            sum += x;
+        }
+        std::cout << sb::allocation_report();
+        assert(sum == 4950 && sb::allocation_total().allocations <= v.size() + 8);
+
+        std::cout << "test allocation_report() after where(predicate).select(selector):" << std::endl;
+        sb::reset_allocation_report();
+        for (auto x : sb::from(v).where([](int x){return x % 2 == 0; }).select([](int x){return x * 2; })) {
+            sum += x;
+        }
+        std::cout << sb::allocation_report();
+        assert(sb::allocation_total().allocations <= 4 * v.size() + 16);
+        assert(sb::allocation_report()["select"].allocations <= v.size() + 8);
+
+        std::cout << "test allocation_report() after group_by(key_selector):" << std::endl;
+        sb::reset_allocation_report();
+        auto groups = sb::from(v).group_by([](int x){return x % 10; }).count();
+        std::cout << sb::allocation_report();
+        assert(groups == 10 && sb::allocation_report()["group_by"].control_blocks <= 2 * static_cast<std::size_t>(groups) + 4);
+
+        std::cout << "test allocation_report() after distinct():" << std::endl;
+        sb::reset_allocation_report();
+        auto distinct = sb::from(v).distinct().to_vector();
+        std::cout << sb::allocation_report();
+        assert(distinct.size() == v.size() && sb::allocation_report()["distinct"].control_blocks <= 4);
+    }
+#endif
 }